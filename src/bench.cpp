@@ -0,0 +1,177 @@
+#include "include/scenes.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Primary-ray throughput of the scene's camera rays, traced one at a time and as 4, 8 and
+// 16-wide packets. Each configuration runs `repeats` times and the best time is reported.
+void bench_primary_rays(int scene_index, int image_width, int repeats) {
+	scene s;
+	if (!build_scene(scene_index, s)) {
+		std::cerr << "Unrecognized scene " << scene_index << ".\n";
+		return;
+	}
+
+	s.cam.image_width = image_width;
+	double scalar_rate = 0;
+
+	for (int packet_size : {1, 4, 8, 16}) {
+		s.cam.packet_size = packet_size;
+		double best = infinity;
+		long long rays = 0;
+		long long hits = 0;
+
+		for (int r = 0; r < repeats; ++r) {
+			auto start = std::chrono::steady_clock::now();
+			hits = s.cam.trace_primary_rays(s.world);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			best = std::min(best, seconds);
+		}
+
+		rays = (long long)image_width * int(image_width / s.cam.aspect_ratio);
+		double rate = rays / best / 1e6;
+		if (packet_size == 1) scalar_rate = rate;
+
+		std::cout << "scene " << scene_index << "  packet " << packet_size << ": " << rate << " Mrays/s  ("
+				  << hits << "/" << rays << " hit, " << rate / scalar_rate << "x scalar)\n";
+	}
+}
+
+// One end-to-end run of a scene: how long the scene took to build and to render
+// on the given number of threads, and how many rays that traced.
+struct scaling_run {
+	int scene;
+	int width, height, samples, threads;
+	double build_seconds, bvh_build_seconds, render_seconds;
+	long long rays;
+	double speedup, efficiency; // Against the same scene on one thread
+};
+
+// Build and render each scene at a reduced size once per thread count, keeping the best of
+// `repeats` renders. Samples are seeded from (pixel, sample), so every thread count does the same
+// work, and the scene is built on the same threads, so the build time scales as well.
+void bench_scaling(const std::vector<int>& scenes, int image_width, int samples, const std::vector<int>& thread_counts, int repeats, std::vector<scaling_run>& runs) {
+	for (int index : scenes) {
+		double single_thread_seconds = 0;
+
+		for (int threads : thread_counts) {
+			// Scenes with random content draw it from the thread's generator; starting it from its
+			// default state builds the same scene as a fresh `main` process.
+			thread_rng() = pcg32();
+			thread_rng4() = pcg32x4();
+			omp_set_num_threads(threads);
+
+			scene s;
+			double bvh_before = bvh_node::total_build_seconds;
+			auto build_start = std::chrono::steady_clock::now();
+			if (!build_scene(index, s)) {
+				std::cerr << "Unrecognized scene " << index << ".\n";
+				break;
+			}
+			double build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count();
+			double bvh_build_seconds = bvh_node::total_build_seconds - bvh_before;
+
+			s.cam.image_width = image_width;
+			s.cam.random_samples_per_pixel = samples;
+			s.cam.write_output = false;
+			s.cam.threads = threads;
+			double best = infinity;
+			for (int r = 0; r < repeats; ++r) {
+				auto start = std::chrono::steady_clock::now();
+				s.cam.render(s.world);
+				best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+			}
+			if (threads == 1) single_thread_seconds = best;
+
+			scaling_run run;
+			run.scene = index;
+			run.width = image_width;
+			run.height = std::max(1, int(image_width / s.cam.aspect_ratio));
+			run.samples = samples;
+			run.threads = threads;
+			run.build_seconds = build_seconds;
+			run.bvh_build_seconds = bvh_build_seconds;
+			run.render_seconds = best;
+			run.rays = s.cam.counters.rays();
+			run.speedup = single_thread_seconds > 0 ? single_thread_seconds / best : 0;
+			run.efficiency = run.speedup / threads;
+			runs.push_back(run);
+		}
+	}
+}
+
+void write_scaling_csv(std::ostream& out, const std::vector<scaling_run>& runs) {
+	out << "scene,width,height,samples,threads,build_seconds,bvh_build_seconds,render_seconds,rays,mrays_per_second,speedup,efficiency\n";
+	for (const auto& r : runs) {
+		out << r.scene << "," << r.width << "," << r.height << "," << r.samples << "," << r.threads << ","
+			<< r.build_seconds << "," << r.bvh_build_seconds << "," << r.render_seconds << "," << r.rays << ","
+			<< r.rays / r.render_seconds / 1e6 << "," << r.speedup << "," << r.efficiency << "\n";
+	}
+}
+
+void write_scaling_json(std::ostream& out, const std::vector<scaling_run>& runs) {
+	out << "[\n";
+	for (size_t k = 0; k < runs.size(); ++k) {
+		const auto& r = runs[k];
+		out << "  {\"scene\": " << r.scene << ", \"width\": " << r.width << ", \"height\": " << r.height
+			<< ", \"samples\": " << r.samples << ", \"threads\": " << r.threads
+			<< ", \"build_seconds\": " << r.build_seconds << ", \"bvh_build_seconds\": " << r.bvh_build_seconds
+			<< ", \"render_seconds\": " << r.render_seconds << ", \"rays\": " << r.rays
+			<< ", \"mrays_per_second\": " << r.rays / r.render_seconds / 1e6
+			<< ", \"speedup\": " << r.speedup << ", \"efficiency\": " << r.efficiency << "}"
+			<< (k + 1 < runs.size() ? "," : "") << "\n";
+	}
+	out << "]\n";
+}
+
+int main(int argc, char* argv[]) {
+	// Defaults to the Stanford dragon (10) and bunny (11) scenes.
+	// With --scaling, renders every scene on 1, 2, 4, ... up to --max-threads threads instead.
+	std::vector<int> scenes;
+	int image_width = 0;
+	int repeats = 3;
+	bool scaling = false;
+	int samples = 16;
+	int max_threads = std::max(1, int(std::thread::hardware_concurrency()));
+	std::string output_file;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string option = argv[i];
+		if (option == "--width" && i + 1 < argc) image_width = std::stoi(argv[++i]);
+		else if (option == "--repeats" && i + 1 < argc) repeats = std::max(1, std::stoi(argv[++i]));
+		else if (option == "--scaling") scaling = true;
+		else if (option == "--samples" && i + 1 < argc) samples = std::stoi(argv[++i]);
+		else if (option == "--max-threads" && i + 1 < argc) max_threads = std::max(1, std::stoi(argv[++i]));
+		else if (option == "--output" && i + 1 < argc) output_file = argv[++i];
+		else scenes.push_back(std::stoi(option));
+	}
+
+	if (scaling) {
+		if (scenes.empty()) {
+			for (int index = 0; index <= 13; ++index) scenes.push_back(index);
+		}
+		std::vector<int> thread_counts;
+		for (int threads = 1; threads < max_threads; threads *= 2) thread_counts.push_back(threads);
+		thread_counts.push_back(max_threads);
+
+		std::vector<scaling_run> runs;
+		bench_scaling(scenes, image_width > 0 ? image_width : 200, samples, thread_counts, repeats, runs);
+
+		bool json = output_file.size() >= 5 && output_file.compare(output_file.size() - 5, 5, ".json") == 0;
+		std::ofstream file;
+		if (!output_file.empty()) file.open(output_file);
+		std::ostream& out = output_file.empty() ? std::cout : file;
+		if (json) write_scaling_json(out, runs);
+		else write_scaling_csv(out, runs);
+		return 0;
+	}
+
+	if (scenes.empty()) scenes = {10, 11};
+	if (image_width <= 0) image_width = 800;
+
+	for (int index : scenes) bench_primary_rays(index, image_width, repeats);
+}
@@ -112,19 +112,42 @@ inline vec3d unit_vector(const vec3d& v) {
     return v / v.length();
 }
 
-inline vec3d random_unit_vector() {
-	while (true) {
-		auto t = vec3d::random(-1, 1);
-		auto lensq = t.length_squared();
-		if (1e-160 < lensq && lensq <= 1) return t / sqrt(lensq);
+// Map two uniform values to a uniform direction on the unit sphere.
+inline vec3d sample_unit_vector(double u1, double u2) {
+	auto z = 1 - 2*u1;
+	auto r = std::sqrt(std::fmax(0.0, 1 - z*z));
+	auto phi = 2*pi*u2;
+	return vec3d(r*std::cos(phi), r*std::sin(phi), z);
+}
+
+// Map two uniform values to a uniform point in the unit disk (Shirley-Chiu concentric map, which
+// keeps stratified inputs stratified).
+inline vec3d sample_in_unit_disk(double u1, double u2) {
+	auto a = 2*u1 - 1;
+	auto b = 2*u2 - 1;
+	if (a == 0 && b == 0) return vec3d(0, 0, 0);
+
+	double r, theta;
+	if (std::fabs(a) > std::fabs(b)) {
+		r = a;
+		theta = (pi/4) * (b/a);
+	} else {
+		r = b;
+		theta = (pi/2) - (pi/4) * (a/b);
 	}
+	return vec3d(r*std::cos(theta), r*std::sin(theta), 0);
+}
+
+inline vec3d random_unit_vector() {
+	double r[4];
+	random_double4(r);
+	return sample_unit_vector(r[0], r[1]);
 }
 
 inline vec3d random_in_unit_disk() {
-	while (true) {
-		auto p = vec3d(random_double_range(-1, 1), random_double_range(-1, 1), 0);
-		if (p.length_squared() < 1) return p;
-	}
+	double r[4];
+	random_double4(r);
+	return sample_in_unit_disk(r[0], r[1]);
 }
 
 inline vec3d random_on_hemisphere(const vec3d& normal) {
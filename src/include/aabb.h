@@ -1,5 +1,8 @@
 #pragma once
 
+#include "ray_packet.h"
+#include "render_stats.h"
+
 class aabb {
 	public:
 		interval x, y, z;
@@ -34,6 +37,7 @@ class aabb {
 		bool intersect(const ray& r, interval ray_t) const {
 			const point3d& ray_orig = r.origin();
 			const vec3d& ray_dir = r.direction();
+			thread_counters.box_tests++;
 
 			for (int axis = 0; axis < 3; ++axis) {
 				const interval& ax = axis_interval(axis);
@@ -55,12 +59,41 @@ class aabb {
 			return true;
 		}
 
+		// Slab test of every lane of the packet at once. Returns the lanes of mask that hit the box
+		// within their [t_min, t_max].
+		uint32_t intersect_packet(const ray_packet& p, uint32_t mask) const {
+			bool lane_hit[ray_packet::max_size];
+			thread_counters.box_tests += __builtin_popcount(mask);
+
+			#pragma omp simd
+			for (int i = 0; i < p.size; ++i) {
+				double tx0 = (x.min - p.origin_x[i]) * p.inv_direction_x[i];
+				double tx1 = (x.max - p.origin_x[i]) * p.inv_direction_x[i];
+				double ty0 = (y.min - p.origin_y[i]) * p.inv_direction_y[i];
+				double ty1 = (y.max - p.origin_y[i]) * p.inv_direction_y[i];
+				double tz0 = (z.min - p.origin_z[i]) * p.inv_direction_z[i];
+				double tz1 = (z.max - p.origin_z[i]) * p.inv_direction_z[i];
+
+				double t_enter = std::max(std::max(p.t_min[i], std::min(tx0, tx1)), std::max(std::min(ty0, ty1), std::min(tz0, tz1)));
+				double t_exit = std::min(std::min(p.t_max[i], std::max(tx0, tx1)), std::min(std::max(ty0, ty1), std::max(tz0, tz1)));
+				lane_hit[i] = t_enter < t_exit;
+			}
+
+			uint32_t result = 0;
+			for (int i = 0; i < p.size; ++i) result |= uint32_t(lane_hit[i]) << i;
+			return result & mask;
+		}
+
 		// Return the longest axis of the bounding box
 		int longest_axis() const {
 			if (x.size() > y.size()) return x.size() > z.size() ? 0 : 2;
 			else return y.size() > z.size() ? 1 : 2;
 		}
 
+		double surface_area() const {
+			return 2 * (x.size() * y.size() + y.size() * z.size() + z.size() * x.size());
+		}
+
 		static const aabb empty, universe;
 private:
 	void pad_to_minimums() {
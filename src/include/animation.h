@@ -0,0 +1,189 @@
+#pragma once
+
+#include "camera.h"
+#include "film.h"
+#include "image_output.h"
+#include "instance.h"
+#include "intersectable.h"
+#include "intersectable_objects.h"
+
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A value keyed at points in time. Linearly interpolated between keys and held before the first
+// and after the last.
+template <typename T>
+class keyframes {
+	public:
+		void add(double time, const T& value) {
+			auto it = keys.begin();
+			while (it != keys.end() && it->time <= time) ++it;
+			keys.insert(it, {time, value});
+		}
+
+		bool empty() const { return keys.empty(); }
+
+		T at(double time) const {
+			if (time <= keys.front().time) return keys.front().value;
+			for (size_t k = 1; k < keys.size(); ++k) {
+				if (time <= keys[k].time) {
+					double t = (time - keys[k - 1].time) / (keys[k].time - keys[k - 1].time);
+					return keys[k - 1].value + t * (keys[k].value - keys[k - 1].value);
+				}
+			}
+			return keys.back().value;
+		}
+
+	private:
+		struct key {
+			double time;
+			T value;
+		};
+		std::vector<key> keys;
+};
+
+// An object turned about the y axis through pivot and then moved by offset, both keyframed.
+// Only the transform changes between frames; the object and its BVH are never touched.
+class animated_instance : public intersectable {
+	public:
+		keyframes<double> angle; // Degrees about the y axis through the pivot
+		keyframes<vec3d> offset;
+
+		animated_instance(shared_ptr<intersectable> object, const point3d& pivot)
+			: pivot(pivot), placement(make_shared<instance>(object, transform())) {}
+
+		// Pose the object for the given time. Bounds are updated on the next refit().
+		void set_time(double time) {
+			double degrees = angle.empty() ? 0 : angle.at(time);
+			vec3d moved = offset.empty() ? vec3d(0, 0, 0) : offset.at(time);
+			placement->set_transform(transform::translation(pivot + moved) * transform::rotation_y(degrees) * transform::translation(-pivot));
+		}
+
+		bool intersect(const ray& r, interval ray_t, intersects& inte) const override {
+			return placement->intersect(r, ray_t, inte);
+		}
+
+		void intersect_packet(ray_packet& packet, intersects* hits, uint32_t mask) const override {
+			placement->intersect_packet(packet, hits, mask);
+		}
+
+		aabb bounding_box() const override { return placement->bounding_box(); }
+
+		void refit() override { placement->refit(); }
+
+		void account_memory(memory_usage& usage) const override {
+			usage.add(memory_usage::instances, "animated_instance", shared_bytes<animated_instance>());
+			placement->account(usage);
+		}
+
+	private:
+		point3d pivot;
+		shared_ptr<instance> placement;
+};
+
+// Keyframed camera and objects of a scene, over times [0, 1].
+struct animation {
+	keyframes<point3d> look_from;
+	keyframes<point3d> look_at;
+	keyframes<double> vfov;
+	std::vector<shared_ptr<animated_instance>> instances;
+
+	bool empty() const {
+		return look_from.empty() && look_at.empty() && vfov.empty() && instances.empty();
+	}
+
+	// Camera that circles look_at once around the vertical axis, starting from look_from.
+	static animation orbit(const camera& cam, int keys = 36) {
+		animation a;
+		vec3d arm = cam.look_from - cam.look_at;
+		for (int k = 0; k <= keys; ++k) {
+			double theta = 2 * pi * k / keys;
+			vec3d turned(std::cos(theta) * arm.x() + std::sin(theta) * arm.z(), arm.y(), -std::sin(theta) * arm.x() + std::cos(theta) * arm.z());
+			a.look_from.add(double(k) / keys, cam.look_at + turned);
+		}
+		return a;
+	}
+
+	// Pose the camera and the instances for the given time.
+	void apply(double time, camera& cam) const {
+		if (!look_from.empty()) cam.look_from = look_from.at(time);
+		if (!look_at.empty()) cam.look_at = look_at.at(time);
+		if (!vfov.empty()) cam.vfov = vfov.at(time);
+		for (const auto& instance : instances) instance->set_time(time);
+	}
+};
+
+// File name of a frame. The first printf-style integer conversion in the pattern ("%d", "%04d")
+// is replaced with the frame number; without one, the number goes before the extension as four
+// digits. The pattern is never used as a format string, so any other '%' is kept as it is.
+inline std::string frame_file_name(const std::string& pattern, int frame) {
+	for (size_t start = pattern.find('%'); start != std::string::npos; start = pattern.find('%', start + 1)) {
+		size_t end = start + 1;
+		while (end < pattern.size() && std::isdigit((unsigned char)pattern[end])) ++end;
+		if (end == pattern.size() || pattern[end] != 'd') continue;
+
+		std::string spec = pattern.substr(start + 1, end - start - 1);
+		size_t width = spec.empty() ? 0 : std::min<size_t>(std::stoul(spec), 64);
+		std::string number = std::to_string(frame);
+		if (number.size() < width) number.insert(0, width - number.size(), spec[0] == '0' ? '0' : ' ');
+		return pattern.substr(0, start) + number + pattern.substr(end + 1);
+	}
+
+	std::string number = std::to_string(frame);
+	if (number.size() < 4) number.insert(0, 4 - number.size(), '0');
+	auto dot = pattern.rfind('.');
+	if (dot == std::string::npos) return pattern + number;
+	return pattern.substr(0, dot) + number + pattern.substr(dot);
+}
+
+// Render frames of the animation with the same world, meshes and textures throughout. Between
+// frames the animated objects are posed and the world's BVH bounds refit rather than rebuilt.
+// Frames go to numbered image files, or as one Y4M stream to a .y4m file or standard output.
+// A stats report is written per frame, numbered like the image files.
+inline void render_sequence(intersectable& world, camera& cam, const animation& anim, int frames, int fps, std::string output) {
+	bool video = output.empty() || (output.size() >= 4 && output.compare(output.size() - 4, 4, ".y4m") == 0);
+
+	std::ofstream video_file;
+	if (video && !output.empty()) {
+		video_file.open(output, std::ios::binary);
+		if (!video_file) {
+			std::cerr << "ERROR: Could not open output file '" << output << "'.\n";
+			return;
+		}
+	}
+
+	cam.write_output = !video;
+	int width = cam.image_width;
+	int height = std::max(1, int(width / cam.aspect_ratio));
+	std::unique_ptr<y4m_stream> stream;
+	if (video) stream = std::make_unique<y4m_stream>(video_file.is_open() ? video_file : std::cout, width, height, fps);
+	std::vector<color> pixels(size_t(width) * height);
+	std::string stats = cam.stats_file;
+	std::string heatmap = cam.heatmap_file;
+
+	for (int f = 0; f < frames; ++f) {
+		double time = double(f) / frames; // Stops short of 1 so that looping animations loop cleanly
+
+		auto start = std::chrono::steady_clock::now();
+		anim.apply(time, cam);
+		world.refit();
+		double refit_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::clog << "Frame " << f + 1 << "/" << frames << " (refit " << refit_ms << " ms)\n";
+
+		cam.frame = f;
+		if (!video) cam.output_file = frame_file_name(output, f);
+		if (!stats.empty()) cam.stats_file = frame_file_name(stats, f);
+		if (!heatmap.empty()) cam.heatmap_file = frame_file_name(heatmap, f);
+		film image = cam.render(world);
+
+		if (video) {
+			for (size_t p = 0; p < pixels.size(); ++p) pixels[p] = image.pixel(p);
+			stream->add_frame(pixels);
+		}
+	}
+}
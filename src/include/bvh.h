@@ -3,71 +3,586 @@
 #include "aabb.h"
 #include "intersectable.h"
 #include "intersectable_objects.h"
+#include "trace.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <omp.h>
 
+// Bounding volume hierarchy over a set of objects. It is built as a binary tree by the surface
+// area heuristic, then collapsed into a tree of up to width children per node. A node keeps its
+// children's boxes side by side, one array per bound, so that one loop tests the ray against
+// all of them. The nodes are one array in depth-first order, and each leaf names a range of the
+// tree's own list of objects. Traversal is a loop over an explicit stack rather than recursion
+// through virtual calls. The build runs as OpenMP tasks, and gives the same tree on any number
+// of threads.
 class bvh_node : public intersectable {
 public:
 	bvh_node(intersectable_list list) : bvh_node(list.objects, 0, list.objects.size()) {
 	}
 
-	bvh_node(std::vector<shared_ptr<intersectable>>& objects, size_t start, size_t end) {
-		bbox = aabb::empty;
-		for (size_t object_index = start; object_index < end; object_index++) {
-			bbox = aabb(bbox, objects[object_index]->bounding_box());
-		}
-		int axis = bbox.longest_axis();
+	// Time spent building trees so far, summed over every tree built, so trees built at the same
+	// time each count in full.
+	inline static double total_build_seconds = 0;
 
-		auto comparator = (axis == 0) ? box_x_compare : (axis == 1) ? box_y_compare : box_z_compare;
+	// Settings of the trees built from then on. Costs are relative: a node's box test against a
+	// primitive intersection test.
+	inline static int max_leaf_size = 4; // Most primitives a leaf may hold
+	inline static double traversal_cost = 1;
+	inline static double intersection_cost = 1;
 
-		size_t object_span = end - start;
+	bvh_node(std::vector<shared_ptr<intersectable>>& objects, size_t start, size_t end) {
+		TRACE_SCOPE("bvh build", std::to_string(end - start) + " objects");
+		auto build_start = std::chrono::steady_clock::now();
 
-		if (object_span == 1) {
-			left = right = objects[start];
-		} else if (object_span == 2) {
-			left = objects[start];
-			right = objects[start+1];
-		} else {
-			std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
+		// Nothing to hold is an empty tree, e.g. for a mesh file that failed to load.
+		bbox = aabb::empty;
+		std::vector<build_primitive> prims(end - start);
+		std::vector<binary_node> binary;
+		with_task_team([&] {
+			// Every object's box and centroid are taken once, and the builder works on those alone.
+			#pragma omp taskloop default(shared) grainsize(task_grain)
+			for (size_t k = 0; k < prims.size(); ++k) {
+				aabb box = objects[start + k]->bounding_box();
+				point3d centroid(box.x.min + box.x.size() / 2, box.y.min + box.y.size() / 2, box.z.min + box.z.size() / 2);
+				prims[k] = {box, centroid, start + k};
+			}
 
-			auto mid = start + object_span/2;
-			left = make_shared<bvh_node>(objects, start, mid);
-			right = make_shared<bvh_node>(objects, mid, end);
+			// Objects without finite bounds, such as empty trees, can't be binned and are left out.
+			prims.erase(std::remove_if(prims.begin(), prims.end(), [](const build_primitive& p) { return !finite(p.box); }), prims.end());
+			if (prims.empty()) return;
 
+			binary.reserve(2 * prims.size());
+			bbox = primitive_bounds(prims, 0, prims.size());
+			sah = build(prims, 0, prims.size(), bbox, 0, binary) / bbox.surface_area();
+		});
+
+		if (!binary.empty()) {
+			// Leaves hold ranges of the primitives in their final order.
+			primitives.reserve(prims.size());
+			for (const auto& p : prims) primitives.push_back(objects[p.index]);
+			nodes.reserve(binary.size() / (width - 1) + 1);
+			collapse(binary, 0);
 		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count();
+		#pragma omp atomic
+		total_build_seconds += seconds;
 	}
 
+	// Expected cost of tracing a ray that hits the root box, by the surface area heuristic: the
+	// traversal and intersection costs of every node and leaf, weighted by the chance that a ray
+	// through the root passes through them (the ratio of their surface areas).
+	double sah_cost() const { return sah; }
+
 	bool intersect(const ray& r, interval ray_t, intersects& inte) const override {
-		if (!bbox.intersect(r, ray_t)) return false;
+		if (nodes.empty()) return false;
+		return traverse(0, r, ray_t, inte);
+	}
+
+	// Test each node's child boxes for the whole packet and descend with the lanes that hit them,
+	// switching to per-lane traversal of a subtree once too few lanes are left.
+	void intersect_packet(ray_packet& packet, intersects* hits, uint32_t mask) const override {
+		if (nodes.empty()) return;
+
+		struct entry {
+			uint32_t child;
+			uint32_t count; // Of a leaf's primitives, 0 for a node
+			uint32_t lanes;
+		};
+		entry stack[stack_size];
+		int top = 0;
+		stack[top++] = {0, 0, mask};
 
-		bool intersect_left = left->intersect(r, ray_t, inte);
-		bool intersect_right = right->intersect(r, interval(ray_t.min, intersect_left ? inte.t : ray_t.max), inte);
+		while (top > 0) {
+			entry e = stack[--top];
+			if (e.count > 0) {
+				for (uint32_t k = e.child; k < e.child + e.count; ++k) primitives[k]->intersect_packet(packet, hits, e.lanes);
+				continue;
+			}
 
-		return intersect_left || intersect_right;
+			if (packet.diverged(e.lanes)) {
+				uint32_t lanes = e.lanes;
+				while (lanes) {
+					int lane = __builtin_ctz(lanes);
+					lanes &= lanes - 1;
+
+					packet.begin_lane(lane);
+					intersects temp_inte;
+					if (traverse(e.child, packet.rays[lane], interval(packet.t_min[lane], packet.t_max[lane]), temp_inte)) {
+						hits[lane] = temp_inte;
+						packet.t_max[lane] = temp_inte.t;
+						packet.hit[lane] = true;
+					}
+					packet.end_lane(lane);
+				}
+				continue;
+			}
+
+			const wide_node& node = nodes[e.child];
+			thread_counters.bvh_nodes++;
+			thread_counters.box_tests += __builtin_popcount(e.lanes) * node.children;
+
+			// Children go on the stack farthest first, by the entry distances of the first lane.
+			int lane = __builtin_ctz(e.lanes);
+			double origin[3] = {packet.origin_x[lane], packet.origin_y[lane], packet.origin_z[lane]};
+			double inv_direction[3] = {packet.inv_direction_x[lane], packet.inv_direction_y[lane], packet.inv_direction_z[lane]};
+			double t_enter[width];
+			child_distances(node, origin, inv_direction, interval(packet.t_min[lane], infinity), t_enter);
+
+			int order[width];
+			for (int c = 0; c < node.children; ++c) order[c] = c;
+			std::sort(order, order + node.children, [&](int a, int b) { return t_enter[a] > t_enter[b]; });
+			for (int k = 0; k < node.children; ++k) {
+				int c = order[k];
+				uint32_t lanes = child_hit_packet(node, c, packet, e.lanes);
+				if (lanes) stack[top++] = {node.child[c], node.count[c], lanes};
+			}
+		}
 	}
 
 	aabb bounding_box() const override { return bbox; }
 
+	// Keep the tree structure and only recompute the boxes. Cheap compared to a rebuild, but the
+	// tree gets looser the further objects move from where it was built.
+	void refit() override {
+		for (const auto& object : primitives) object->refit();
+		bbox = nodes.empty() ? aabb::empty : refit_node(0);
+	}
+
+	void account_memory(memory_usage& usage) const override {
+		usage.add(memory_usage::bvh, "bvh_node", shared_bytes<bvh_node>() + nodes.capacity() * sizeof(wide_node)
+										   + primitives.capacity() * sizeof(shared_ptr<intersectable>));
+		for (const auto& object : primitives) object->account(usage);
+	}
+
 private:
-	shared_ptr<intersectable> left;
-	shared_ptr<intersectable> right;
+	// Children per node. The child boxes of a node are tested in one loop, which the compiler
+	// vectorizes over the children.
+	static constexpr int width = 8;
+
+	// Up to width children: the first `children` slots are used. A slot with count 0 is a node,
+	// otherwise a leaf of count primitives. Bounds are floats rounded outwards, so a box never
+	// shrinks. Aligned to cache lines; 256 bytes with a width of 8.
+	struct alignas(64) wide_node {
+		float low_x[width], low_y[width], low_z[width];
+		float high_x[width], high_y[width], high_z[width];
+		uint32_t child[width]; // The node's index, or the leaf's first primitive
+		uint8_t count[width];
+		uint8_t children;
+	};
+
+	// Node of the binary tree the builder makes, before it is collapsed.
+	struct binary_node {
+		aabb box;
+		uint32_t offset; // A leaf's first primitive, or an inner node's second child
+		uint32_t count; // Primitives in a leaf, 0 for an inner node
+	};
+
+	// Deepest binary tree built. Past sah_depth the builder only halves the primitives, which keeps
+	// any tree of fewer than 2^32 primitives within max_depth. The wide tree is no deeper, and
+	// each node visited leaves at most width - 1 more entries on the traversal stack.
+	static constexpr int max_depth = 64;
+	static constexpr int sah_depth = 32;
+	static constexpr int stack_size = max_depth * (width - 1) + 1;
+
+	std::vector<wide_node> nodes;
+	std::vector<shared_ptr<intersectable>> primitives; // In leaf order
 	aabb bbox;
+	double sah = 0;
+
+	static void set_child_bounds(wide_node& node, int c, const aabb& box) {
+		float* low[3] = {node.low_x, node.low_y, node.low_z};
+		float* high[3] = {node.high_x, node.high_y, node.high_z};
+		for (int axis = 0; axis < 3; ++axis) {
+			const interval& range = box.axis_interval(axis);
+			float l = float(range.min);
+			float h = float(range.max);
+			if (double(l) > range.min) l = std::nextafter(l, -INFINITY);
+			if (double(h) < range.max) h = std::nextafter(h, INFINITY);
+			low[axis][c] = l;
+			high[axis][c] = h;
+		}
+	}
+
+	// Slab test of the ray against every child box of the node at once. t_enter[c] is where the
+	// ray enters child c within ray_t, infinity if it misses it.
+	static void child_distances(const wide_node& node, const double* origin, const double* inv_direction, const interval& ray_t, double* t_enter) {
+		int children = node.children; // As an int, so the loop vectorizes
+		#pragma omp simd
+		for (int c = 0; c < width; ++c) {
+			double tx0 = (node.low_x[c] - origin[0]) * inv_direction[0];
+			double tx1 = (node.high_x[c] - origin[0]) * inv_direction[0];
+			double ty0 = (node.low_y[c] - origin[1]) * inv_direction[1];
+			double ty1 = (node.high_y[c] - origin[1]) * inv_direction[1];
+			double tz0 = (node.low_z[c] - origin[2]) * inv_direction[2];
+			double tz1 = (node.high_z[c] - origin[2]) * inv_direction[2];
+
+			double enter = std::max(std::max(ray_t.min, std::min(tx0, tx1)), std::max(std::min(ty0, ty1), std::min(tz0, tz1)));
+			double exit = std::min(std::min(ray_t.max, std::max(tx0, tx1)), std::min(std::max(ty0, ty1), std::max(tz0, tz1)));
+			t_enter[c] = c < children && enter < exit ? enter : infinity;
+		}
+	}
+
+	// Slab test of child c's box for the lanes of mask, as aabb::intersect_packet.
+	static uint32_t child_hit_packet(const wide_node& node, int c, const ray_packet& p, uint32_t mask) {
+		bool lane_hit[ray_packet::max_size];
+
+		#pragma omp simd
+		for (int i = 0; i < p.size; ++i) {
+			double tx0 = (node.low_x[c] - p.origin_x[i]) * p.inv_direction_x[i];
+			double tx1 = (node.high_x[c] - p.origin_x[i]) * p.inv_direction_x[i];
+			double ty0 = (node.low_y[c] - p.origin_y[i]) * p.inv_direction_y[i];
+			double ty1 = (node.high_y[c] - p.origin_y[i]) * p.inv_direction_y[i];
+			double tz0 = (node.low_z[c] - p.origin_z[i]) * p.inv_direction_z[i];
+			double tz1 = (node.high_z[c] - p.origin_z[i]) * p.inv_direction_z[i];
+
+			double t_enter = std::max(std::max(p.t_min[i], std::min(tx0, tx1)), std::max(std::min(ty0, ty1), std::min(tz0, tz1)));
+			double t_exit = std::min(std::min(p.t_max[i], std::max(tx0, tx1)), std::min(std::max(ty0, ty1), std::max(tz0, tz1)));
+			lane_hit[i] = t_enter < t_exit;
+		}
+
+		uint32_t result = 0;
+		for (int i = 0; i < p.size; ++i) result |= uint32_t(lane_hit[i]) << i;
+		return result & mask;
+	}
+
+	// Closest hit of the ray in the subtree under node root. Children are visited nearest first,
+	// and any whose box the ray enters beyond the closest hit so far is skipped.
+	bool traverse(uint32_t root, const ray& r, interval ray_t, intersects& inte) const {
+		double origin[3] = {r.origin().x(), r.origin().y(), r.origin().z()};
+		double inv_direction[3] = {1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z()};
+
+		struct entry {
+			uint32_t child;
+			uint32_t count; // Of a leaf's primitives, 0 for a node
+			double t; // Where the ray enters the box
+		};
+		entry stack[stack_size];
+		int top = 0;
+		stack[top++] = {root, 0, ray_t.min};
+		bool found = false;
+
+		while (top > 0) {
+			entry e = stack[--top];
+			if (e.t >= ray_t.max) continue;
+
+			if (e.count > 0) {
+				for (uint32_t k = e.child; k < e.child + e.count; ++k) {
+					if (primitives[k]->intersect(r, ray_t, inte)) {
+						found = true;
+						ray_t.max = inte.t;
+					}
+				}
+				continue;
+			}
+
+			const wide_node& node = nodes[e.child];
+			thread_counters.bvh_nodes++;
+			thread_counters.box_tests += node.children;
+			double t_enter[width];
+			child_distances(node, origin, inv_direction, ray_t, t_enter);
+
+			// Push the children hit farthest first, so that the nearest comes off the stack next.
+			int order[width];
+			int hit = 0;
+			for (int c = 0; c < node.children; ++c) {
+				if (t_enter[c] == infinity) continue;
+				int k = hit++;
+				while (k > 0 && t_enter[order[k - 1]] < t_enter[c]) {
+					order[k] = order[k - 1];
+					k--;
+				}
+				order[k] = c;
+			}
+			for (int k = 0; k < hit; ++k) stack[top++] = {node.child[order[k]], node.count[order[k]], t_enter[order[k]]};
+		}
+		return found;
+	}
+
+	// Recompute the child boxes of the node and everything under it. Returns the node's box.
+	aabb refit_node(uint32_t index) {
+		aabb box = aabb::empty;
+		for (int c = 0; c < nodes[index].children; ++c) {
+			aabb child = aabb::empty;
+			if (nodes[index].count[c] > 0) {
+				uint32_t first = nodes[index].child[c];
+				for (uint32_t k = first; k < first + nodes[index].count[c]; ++k) child = aabb(child, primitives[k]->bounding_box());
+			} else {
+				child = refit_node(nodes[index].child[c]);
+			}
+			set_child_bounds(nodes[index], c, child);
+			box = aabb(box, child);
+		}
+		return box;
+	}
+
+	// Append the wide node for the binary subtree under binary[root], then the nodes under it.
+	// Starting from the root's two children, the inner child with the largest surface area is
+	// replaced by its own two children until the node has width children or only leaves.
+	uint32_t collapse(const std::vector<binary_node>& binary, uint32_t root) {
+		uint32_t slots[width];
+		int used = 0;
+		if (binary[root].count > 0) {
+			slots[used++] = root;
+		} else {
+			slots[used++] = root + 1;
+			slots[used++] = binary[root].offset;
+		}
+
+		while (used < width) {
+			int widest = -1;
+			double widest_area = -1;
+			for (int k = 0; k < used; ++k) {
+				const binary_node& candidate = binary[slots[k]];
+				if (candidate.count == 0 && candidate.box.surface_area() > widest_area) {
+					widest = k;
+					widest_area = candidate.box.surface_area();
+				}
+			}
+			if (widest < 0) break;
+			uint32_t opened = slots[widest];
+			slots[widest] = opened + 1;
+			slots[used++] = binary[opened].offset;
+		}
+
+		uint32_t index = uint32_t(nodes.size());
+		nodes.push_back(wide_node());
+		nodes[index].children = uint8_t(used);
+		for (int c = 0; c < used; ++c) {
+			const binary_node& child = binary[slots[c]];
+			set_child_bounds(nodes[index], c, child.box);
+			nodes[index].count[c] = uint8_t(child.count);
+			// Collapsing the child appends to nodes, so this node is only looked up again after.
+			uint32_t child_index = child.count > 0 ? child.offset : collapse(binary, slots[c]);
+			nodes[index].child[c] = child_index;
+		}
+		return index;
+	}
+
+	struct build_primitive {
+		aabb box;
+		point3d centroid;
+		size_t index; // Into the objects the tree is built from
+	};
+
+	// Ranges of at least this many primitives are built in parallel: their two halves as separate
+	// OpenMP tasks, and their binning in tasks of this many primitives each.
+	static constexpr size_t task_grain = 4096;
+
+	// Run f on one thread of a team, whose other threads take the tasks it makes. Inside a parallel
+	// region already, e.g. while several trees are built at once, that region's team takes them.
+	template <typename F>
+	static void with_task_team(F f) {
+		if (omp_in_parallel()) {
+			f();
+			return;
+		}
+		#pragma omp parallel
+		#pragma omp single
+		f();
+	}
+
+	// Centroids are binned along an axis, and the candidate split planes are the boundaries
+	// between bins.
+	static constexpr int bin_count = 16;
+
+	struct split {
+		int axis = -1; // None when every centroid is at the same point
+		double low = 0, extent = 0; // Centroid range along the axis
+		int bin = 0; // Primitives in bins below this go left
+		double cost = infinity; // Relative to the area of the node being split
+		aabb left_box, right_box; // Bounds of the primitives on either side
+
+		int bin_of(const point3d& centroid) const {
+			return std::min(int(bin_count * (centroid[axis] - low) / extent), bin_count - 1);
+		}
+	};
+
+	// Range of the centroids of some primitives along every axis.
+	struct centroid_range {
+		interval axis[3];
+
+		void add(const centroid_range& other) {
+			for (int a = 0; a < 3; ++a) axis[a] = interval(axis[a], other.axis[a]);
+		}
+	};
+
+	// Boxes and counts of the primitives in each bin along every axis.
+	struct bins {
+		aabb box[3][bin_count];
+		size_t size[3][bin_count] = {};
+
+		void add(const bins& other) {
+			for (int axis = 0; axis < 3; ++axis) {
+				for (int b = 0; b < bin_count; ++b) {
+					box[axis][b] = aabb(box[axis][b], other.box[axis][b]);
+					size[axis][b] += other.size[axis][b];
+				}
+			}
+		}
+	};
 
-	static bool box_compare(const shared_ptr<intersectable> a, const shared_ptr<intersectable> b, int axis_index) {
-		auto a_axis_interval = a->bounding_box().axis_interval(axis_index);
-		auto b_axis_interval = b->bounding_box().axis_interval(axis_index);
-		return a_axis_interval.min < b_axis_interval.min;
+	// Gather prims[start, end) into result with gather(first, last, result). A range of more than
+	// task_grain primitives is gathered in chunks, as tasks with results of their own, which are
+	// added to result after. Ranges and boxes are unions, so the order doesn't change the result.
+	template <typename T, typename Gather>
+	static void gather_chunks(size_t start, size_t end, T& result, Gather gather) {
+		size_t chunks = (end - start + task_grain - 1) / task_grain;
+		if (chunks <= 1) {
+			gather(start, end, result);
+			return;
+		}
+		std::vector<T> partial(chunks);
+		#pragma omp taskloop default(shared)
+		for (size_t chunk = 0; chunk < chunks; ++chunk) {
+			gather(start + chunk * task_grain, std::min(end, start + (chunk + 1) * task_grain), partial[chunk]);
+		}
+		for (const auto& p : partial) result.add(p);
+	}
+
+	static bool finite(const aabb& box) {
+		for (int axis = 0; axis < 3; ++axis) {
+			if (!std::isfinite(box.axis_interval(axis).min) || !std::isfinite(box.axis_interval(axis).max)) return false;
+		}
+		return true;
+	}
+
+	static aabb primitive_bounds(const std::vector<build_primitive>& prims, size_t start, size_t end) {
+		aabb bounds = aabb::empty;
+		for (size_t k = start; k < end; ++k) bounds = aabb(bounds, prims[k].box);
+		return bounds;
 	}
 
-	static bool box_x_compare(const shared_ptr<intersectable> a, const shared_ptr<intersectable> b) {
-		return box_compare(a, b, 0);
+	// Cheapest binned SAH split of prims[start, end), whose boxes are bounded by bounds.
+	static split find_split(const std::vector<build_primitive>& prims, size_t start, size_t end, const aabb& bounds) {
+		centroid_range centroids;
+		gather_chunks(start, end, centroids, [&](size_t first, size_t last, centroid_range& range) {
+			for (size_t k = first; k < last; ++k) {
+				for (int axis = 0; axis < 3; ++axis) {
+					double c = prims[k].centroid[axis];
+					range.axis[axis] = interval(range.axis[axis], interval(c, c));
+				}
+			}
+		});
+
+		split axes[3];
+		for (int axis = 0; axis < 3; ++axis) {
+			axes[axis].axis = axis;
+			axes[axis].low = centroids.axis[axis].min;
+			axes[axis].extent = centroids.axis[axis].max - centroids.axis[axis].min;
+		}
+
+		bins total;
+		gather_chunks(start, end, total, [&](size_t first, size_t last, bins& local) {
+			for (size_t k = first; k < last; ++k) {
+				for (int axis = 0; axis < 3; ++axis) {
+					if (!(axes[axis].extent > 0)) continue;
+					int b = axes[axis].bin_of(prims[k].centroid);
+					local.box[axis][b] = aabb(local.box[axis][b], prims[k].box);
+					local.size[axis][b]++;
+				}
+			}
+		});
+
+		split best;
+		double area = bounds.surface_area();
+		for (int axis = 0; axis < 3; ++axis) {
+			if (!(axes[axis].extent > 0)) continue;
+			const aabb* bin_box = total.box[axis];
+			const size_t* bin_size = total.size[axis];
+
+			// Sweep from the right for the box and count above every plane, then from the left.
+			aabb right_box[bin_count];
+			size_t right_size[bin_count];
+			aabb box = aabb::empty;
+			size_t count = 0;
+			for (int b = bin_count - 1; b > 0; --b) {
+				box = aabb(box, bin_box[b]);
+				count += bin_size[b];
+				right_box[b] = box;
+				right_size[b] = count;
+			}
+
+			box = aabb::empty;
+			count = 0;
+			for (int b = 1; b < bin_count; ++b) {
+				box = aabb(box, bin_box[b - 1]);
+				count += bin_size[b - 1];
+				if (count == 0 || right_size[b] == 0) continue;
+				double cost = traversal_cost + intersection_cost * (box.surface_area() * count + right_box[b].surface_area() * right_size[b]) / area;
+				if (cost < best.cost) {
+					best = axes[axis];
+					best.bin = b;
+					best.cost = cost;
+					best.left_box = box;
+					best.right_box = right_box[b];
+				}
+			}
+		}
+		return best;
 	}
 
-	static bool box_y_compare(const shared_ptr<intersectable> a, const shared_ptr<intersectable> b) {
-		return box_compare(a, b, 1);
+	// Append the binary subtree over prims[start, end), whose boxes are bounded by bounds, to
+	// binary in depth-first order, and leave the primitives of every leaf next to each other in
+	// prims. It is a leaf when testing every primitive is cheaper than the best split by the cost
+	// model. Returns the SAH cost of the subtree, not yet divided by the root's area.
+	static double build(std::vector<build_primitive>& prims, size_t start, size_t end, const aabb& bounds, int depth, std::vector<binary_node>& binary) {
+		uint32_t index = uint32_t(binary.size());
+		binary.push_back({bounds, 0, 0});
+
+		size_t count = end - start;
+		split s = count > 1 && depth < sah_depth ? find_split(prims, start, end, bounds) : split();
+		if (count == 1 || (count <= size_t(std::clamp(max_leaf_size, 1, 255)) && intersection_cost * count <= s.cost)) {
+			binary[index].offset = uint32_t(start);
+			binary[index].count = uint32_t(count);
+			return intersection_cost * count * bounds.surface_area();
+		}
+
+		size_t mid;
+		aabb left_box, right_box;
+		if (s.axis < 0) {
+			// No plane separates the centroids, or the tree is deep already: halve by count.
+			mid = start + count / 2;
+			left_box = primitive_bounds(prims, start, mid);
+			right_box = primitive_bounds(prims, mid, end);
+		} else {
+			auto first = prims.begin();
+			mid = std::partition(first + start, first + end, [&](const build_primitive& p) { return s.bin_of(p.centroid) < s.bin; }) - first;
+			left_box = s.left_box;
+			right_box = s.right_box;
+		}
+
+		double cost = traversal_cost * bounds.surface_area();
+		if (count < task_grain) {
+			cost += build(prims, start, mid, left_box, depth + 1, binary);
+			binary[index].offset = uint32_t(binary.size());
+			cost += build(prims, mid, end, right_box, depth + 1, binary);
+			return cost;
+		}
+
+		// The halves are built at once into trees of their own, which are then appended in order.
+		std::vector<binary_node> left, right;
+		double left_cost, right_cost;
+		#pragma omp task default(shared)
+		left_cost = build(prims, start, mid, left_box, depth + 1, left);
+		right_cost = build(prims, mid, end, right_box, depth + 1, right);
+		#pragma omp taskwait
+
+		append_subtree(binary, left);
+		binary[index].offset = uint32_t(binary.size());
+		append_subtree(binary, right);
+		return cost + left_cost + right_cost;
 	}
 
-	static bool box_z_compare(const shared_ptr<intersectable> a, const shared_ptr<intersectable> b) {
-		return box_compare(a, b, 2);
+	// Append a subtree built on its own, moving the links between its nodes along with it.
+	static void append_subtree(std::vector<binary_node>& binary, const std::vector<binary_node>& subtree) {
+		uint32_t base = uint32_t(binary.size());
+		for (binary_node node : subtree) {
+			if (node.count == 0) node.offset += base;
+			binary.push_back(node);
+		}
 	}
 };
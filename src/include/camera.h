@@ -1,14 +1,34 @@
 #pragma once
 
+#include "film.h"
+#include "image_output.h"
 #include "intersectable.h"
 #include "material.h"
+#include "ray_capture.h"
+#include "ray_packet.h"
+#include "render_stats.h"
+#include "sampler.h"
+#include "tile_scheduler.h"
+#include "trace.h"
 #include <omp.h>
+#include <algorithm>
 #include <atomic>
+#include <csignal>
 #include <vector>
 #include <thread>
+#include <condition_variable>
+#include <mutex>
 #include <chrono>
+#include <fstream>
 #include <iomanip>
 
+static_assert(render_counters::material_kinds == int(material_kind::other) + 1, "one material hit counter per material_kind");
+
+enum class render_mode {
+	path, // Each thread traces one path at a time to completion
+	wavefront // Batches of paths advance one bounce at a time, with hits shaded grouped by material
+};
+
 class camera {
 	public:
 		double aspect_ratio = 1.0;
@@ -23,54 +43,333 @@ class camera {
 		vec3d vup = point3d(0, 1, 0); // Camera's up direction
 		double defocus_angle = 0;
 		double focus_dist = 10; // Distance from camera with perfect focus
+		int tile_size = 32; // Edge length in pixels of the square tiles handed to threads
+		bool cost_ordered_tiles = false; // Measure tile cost in a pilot pass and start the expensive tiles first
+		int pilot_samples_per_pixel = 1; // Samples per pixel spent on the pilot pass
+		int frame = 0; // Frame number mixed into the per-sample random seeds
+		sampler_type sampling = sampler_type::sobol; // Sample pattern used for every sampling decision
+		int russian_roulette_depth = 3; // Bounces before low-throughput paths may be terminated early (0 disables)
+		render_mode mode = render_mode::path; // How paths are scheduled on each thread
+		int wavefront_batch = 4096; // Paths kept in flight per thread in wavefront mode
+		int packet_size = 8; // Camera rays of neighbouring pixels traced together as a packet: 1, 4, 8 or 16
+		std::string output_file; // Image file to write, standard output when empty
+		image_format output_format = image_format::p6; // Encoding of the output image
+		std::string checkpoint_file; // Render state is saved here periodically and on SIGINT/SIGTERM, none when empty
+		double checkpoint_interval = 300; // Minimum seconds between periodic checkpoints
+		int samples_per_pass = 16; // Samples per pixel added between checkpoints
+		bool resume = false; // Continue from the samples in checkpoint_file
+		int region_x0 = 0, region_y0 = 0, region_x1 = -1, region_y1 = -1; // Pixels [x0, x1) x [y0, y1) to render, whole image when empty
+		int first_sample = 0; // First sample index rendered in every pixel
+		int last_sample = -1; // One past the last sample index rendered, random_samples_per_pixel when negative
+		std::string partial_file; // Write the radiance sums and sample counts here instead of an image, for merging
+		bool write_output = true; // Encode the image to output_file or standard output; render() returns it either way
+		double time_budget = 0; // Seconds to render for, adding samples in passes until time is up (0 = no limit)
+		double target_error = 0; // Stop once the RMS noise relative to the image brightness is below this (0 = no target)
+		int max_samples_per_pixel = 1 << 16; // Sample cap when rendering to a time budget or noise target
+		bool adaptive = false; // After a base pass, keep adding samples only where the noise is above adaptive_threshold
+		int adaptive_base_samples = 16; // Samples every pixel gets before its noise is judged
+		double adaptive_threshold = 0.05; // Relative standard error below which a pixel gets no more samples
+		std::string sample_map_file; // Image of the samples taken per pixel, none when empty
+		std::string heatmap_file; // False-colour image of what each pixel cost to render, none when empty
+		cost_metric heatmap_metric = cost_metric::bvh_nodes; // What the heatmap measures
+		std::string stats_file; // JSON report of the render's counters and timings, none when empty
+		std::string scene_name; // Scene named in the stats report
+		double build_seconds = 0; // Time spent loading the scene and building its BVH, for the stats report
+		double bvh_build_seconds = 0; // The part of build_seconds spent building BVHs
+		render_counters counters; // Counts of the last render
+		std::string ray_capture_file; // Every ray traced for a subset of the pixels is written here for replay, none when empty
+		int ray_capture_stride = 61; // Rays of every nth pixel are captured
 
 
-		void render(const intersectable& world) {
+		film render(const intersectable& world) {
+			TRACE_SCOPE("render");
 			initialize();
 
 			omp_set_num_threads(threads);
 
-			std::vector<color> framebuffer(image_width*image_height);
-			std::atomic<int> rows_done = 0;
-			std::atomic<bool> rendering_done = false;
+			// With a time budget or noise target the number of samples is open ended, otherwise it is
+			// random_samples_per_pixel. A slice of the samples starts every pixel at first_sample.
+			bool progressive = time_budget > 0 || target_error > 0;
+			int sample_limit = progressive ? max_samples_per_pixel : random_samples_per_pixel;
+			int end_sample = last_sample < 0 ? sample_limit : std::min(last_sample, sample_limit);
+			int begin_sample = std::clamp(first_sample, 0, end_sample);
+			film image(image_width, image_height);
+			std::fill(image.samples.begin(), image.samples.end(), uint32_t(begin_sample));
+
+			uint64_t hash = scene_hash(world);
+			if (resume && !load_checkpoint(image, hash)) return image;
+
+			std::vector<tile> tiles = region_tiles();
+
+			// A resumed render carries on from the samples every pixel already has.
+			int done_samples = std::clamp(int(*std::min_element(image.samples.begin(), image.samples.end())), begin_sample, end_sample);
+			bool pilot = cost_ordered_tiles && done_samples == begin_sample && begin_sample + pilot_samples_per_pixel < end_sample;
+
+			auto render_start = std::chrono::steady_clock::now();
+			auto elapsed = [&]() {
+				return std::chrono::duration<double>(std::chrono::steady_clock::now() - render_start).count();
+			};
+
+			// Shared with the progress thread: the pass in flight and the estimated end of the render.
+			std::atomic<int> tiles_done = 0;
+			std::atomic<int> pass_number = 0;
+			std::atomic<int> pass_start = done_samples;
+			std::atomic<int> pass_end = done_samples;
+			std::atomic<double> expected_samples = progressive ? 0.0 : double(end_sample);
+			bool rendering_done = false;
+			std::mutex progress_lock;
+			std::condition_variable progress_wake; // Ends the progress thread's wait as soon as rendering is done
+
+			auto current_samples = [&]() {
+				double pass_fraction = tiles.empty() ? 1.0 : double(tiles_done.load()) / tiles.size();
+				return pass_start + pass_fraction * (pass_end - pass_start);
+			};
 
 			std::thread progress_thread([&]() {
+			std::unique_lock<std::mutex> lock(progress_lock);
 			while (!rendering_done) {
-				double pct = 100.0 * rows_done.load() / image_height;
-				std::clog << "\rRendering: " << std::fixed << std::setprecision(2) << pct << "% (" << rows_done << "/" << image_height << ")" << std::flush;
-				std::this_thread::sleep_for(std::chrono::milliseconds(150));
+				double spp = current_samples();
+				double expected = expected_samples.load();
+				std::clog << "\rRendering: pass " << pass_number << ", " << std::fixed << std::setprecision(1) << spp << " spp";
+				if (expected > begin_sample) {
+					double fraction = std::clamp((spp - begin_sample) / (expected - begin_sample), 0.0, 1.0);
+					std::clog << " of " << std::setprecision(0) << expected << " (" << std::setprecision(2) << 100 * fraction << "%)";
+					if (fraction > 0) std::clog << ", ETA " << std::setprecision(0) << elapsed() * (1 - fraction) / fraction << " s";
+				}
+				std::clog << "      " << std::flush;
+				progress_wake.wait_for(lock, std::chrono::milliseconds(150), [&]() { return rendering_done; });
 			}
 		});
 
-			std::cout  << "P3\n" << image_width << ' ' << image_height << "\n255\n" << std::endl;
+			// Partial renders write no image, only the film.
+			bool write_image = write_output && partial_file.empty();
+			std::ofstream file;
+			std::ostream discard(nullptr);
+			if (write_image && !output_file.empty()) {
+				file.open(output_file, std::ios::binary);
+				if (!file) std::cerr << "ERROR: Could not open output file '" << output_file << "'.\n";
+			}
+			image_stream output(!write_image ? discard : output_file.empty() ? std::cout : file, output_format, image_width, image_height);
 
-			#pragma omp parallel for schedule(dynamic)
-			for (int j = 0; j < image_height; ++j) {
-				for (int i = 0; i < image_width; ++i) {
-					color pixel_color(0, 0, 0);
-					for (int sample = 0; sample < random_samples_per_pixel; ++sample) {
-						double u = (i + random_double()) / (image_width - 1);
-						double v = (j + random_double()) / (image_height - 1);
-						ray r = get_ray(i, j);
-						pixel_color += ray_color(r, max_depth, world);
-					}
-					framebuffer[j * image_width + i] = pixel_samples_scale * pixel_color;
+			// Rows are streamed out as soon as every tile overlapping them has finished its last pass.
+			int bands = (image_height + tile_size - 1) / tile_size;
+			std::vector<std::atomic<int>> band_tiles_left(bands);
+			std::vector<char> band_emitted(bands, false);
+			for (const auto& t : tiles) band_tiles_left[t.y0 / tile_size]++;
+
+			auto emit_band = [&](int band) {
+				if (!write_image) return;
+				TRACE_SCOPE("write rows", std::to_string(band * tile_size) + "+");
+				std::vector<color> row;
+				for (int j = band * tile_size; j < std::min(image_height, (band + 1) * tile_size); ++j) {
+					image.row(j, row);
+					output.add_row(j, row.data());
 				}
-			rows_done++;
+				band_emitted[band] = true;
+			};
+
+			// With a checkpoint file, SIGINT and SIGTERM let the tiles in progress finish, then the
+			// samples so far are saved and written out as the image.
+			stop_requested = 0;
+			using signal_handler = void (*)(int);
+			signal_handler previous_sigint = SIG_DFL;
+			signal_handler previous_sigterm = SIG_DFL;
+			if (!checkpoint_file.empty()) {
+				previous_sigint = std::signal(SIGINT, request_stop);
+				previous_sigterm = std::signal(SIGTERM, request_stop);
 			}
 
-			rendering_done = true;
-			progress_thread.join();
+			std::vector<uint32_t> target(image.pixel_count());
+			std::vector<double> pixel_cost(heatmap_file.empty() ? 0 : image.pixel_count());
+			double* cost = heatmap_file.empty() ? nullptr : pixel_cost.data();
 
-			for (int j = 0; j < image_height; ++j) {
-				for (int i = 0; i < image_width; ++i) {
-					write_color(std::cout, framebuffer[j * image_width + i]);
+			// Each worker's counts are collected into its own slot after every tile.
+			// So are the captured rays.
+			std::vector<render_counters> worker_counters(std::max(1, threads));
+			std::vector<std::vector<captured_ray>> worker_rays(std::max(1, threads));
+			auto counted_tile = [&](const tile& t, int worker) {
+				TRACE_SCOPE("tile", std::to_string(t.x0) + "," + std::to_string(t.y0));
+				thread_counters = render_counters();
+				thread_recorder = ray_recorder();
+				if (!ray_capture_file.empty()) {
+					thread_recorder.buffer = &worker_rays[worker];
+					thread_recorder.stride = std::max(1, ray_capture_stride);
+				}
+				render_tile(t, target, world, image, cost);
+				worker_counters[worker].merge(thread_counters);
+				thread_recorder = ray_recorder();
+			};
+			auto last_checkpoint = std::chrono::steady_clock::now();
+			double error = 1;
+			bool out_of_time = false;
+			bool converged = false; // Adaptive sampling found no noisy pixels left
+			int session_samples = done_samples; // Samples a resumed render started with
+
+			// A pass that runs into the time budget leaves its remaining tiles for good.
+			auto deadline_passed = [&]() {
+				return time_budget > 0 && elapsed() >= time_budget;
+			};
+
+			while (done_samples < end_sample && !stop_requested && !out_of_time) {
+				double seconds_per_sample = done_samples > session_samples ? elapsed() / (done_samples - session_samples) : 0;
+				int next = next_pass_target(done_samples, begin_sample, end_sample, pilot, elapsed(), seconds_per_sample, error);
+				if (next <= done_samples) break;
+
+				// Past the base pass of adaptive sampling, only the noisy pixels go on.
+				std::fill(target.begin(), target.end(), uint32_t(next));
+				if (adaptive && done_samples - begin_sample >= adaptive_base_samples && restrict_to_noisy_pixels(image, target) == 0) {
+					converged = true;
+					break;
+				}
+
+				bool final_pass = next == end_sample;
+				pass_number++;
+				pass_start = done_samples;
+				tiles_done = 0;
+				pass_end = next;
+				TRACE_SCOPE("pass", "samples " + std::to_string(done_samples) + " to " + std::to_string(next));
+
+				if (pilot) {
+					pilot = false;
+					tile_scheduler(tiles, threads).run([&](tile& t, int worker) {
+						if (stop_requested || deadline_passed()) return;
+						auto start = std::chrono::steady_clock::now();
+						counted_tile(t, worker);
+						t.cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+						tiles_done++;
+					});
+				} else {
+					auto scheduler = cost_ordered_tiles ? tile_scheduler::cost_ordered(tiles, threads) : tile_scheduler(tiles, threads);
+					scheduler.run([&](const tile& t, int worker) {
+						if (stop_requested || deadline_passed()) return;
+						counted_tile(t, worker);
+						tiles_done++;
+
+						int band = t.y0 / tile_size;
+						if (final_pass && --band_tiles_left[band] == 0) emit_band(band);
+					});
 				}
+
+				out_of_time = tiles_done < int(tiles.size()) && !stop_requested;
+				if (out_of_time || stop_requested) break;
+				done_samples = next;
+
+				// Estimate where the render will end from how fast samples are going and, with a noise
+				// target, from the error falling as one over the square root of the sample count.
+				error = progressive ? image.relative_rms_error() : 0;
+				if (progressive) {
+					double expected = end_sample;
+					double samples_per_second = (done_samples - session_samples) / std::max(elapsed(), 1e-9);
+					if (time_budget > 0) expected = std::min(expected, session_samples + samples_per_second * time_budget);
+					if (target_error > 0 && error > 0) expected = std::min(expected, done_samples * (error / target_error) * (error / target_error));
+					expected_samples = std::max(expected, double(done_samples));
+				}
+
+				double since_checkpoint = std::chrono::duration<double>(std::chrono::steady_clock::now() - last_checkpoint).count();
+				if (!checkpoint_file.empty() && !final_pass && since_checkpoint >= checkpoint_interval) {
+					save_checkpoint(image, hash);
+					last_checkpoint = std::chrono::steady_clock::now();
+				}
+			}
+
+			{
+				std::lock_guard<std::mutex> guard(progress_lock);
+				rendering_done = true;
+			}
+			progress_wake.notify_one();
+			progress_thread.join();
+
+			TRACE_SCOPE("write output"); // The rest of the render: image, checkpoint and reports
+			if (!checkpoint_file.empty()) {
+				std::signal(SIGINT, previous_sigint);
+				std::signal(SIGTERM, previous_sigterm);
+				save_checkpoint(image, hash);
 			}
 
-			std::clog << "\rRendering: 100% (" << image_height << "/" << image_height << ")      \n";
+			// Rows an interrupted (or already complete) render never streamed.
+			for (int band = 0; band < bands; ++band) {
+				if (!band_emitted[band]) emit_band(band);
+			}
+			output.finish();
+
+			if (!partial_file.empty()) save_partial(image, hash, begin_sample);
+			if (!sample_map_file.empty()) write_sample_map(image);
+			if (!ray_capture_file.empty()) save_captured_rays(world, worker_rays);
+
+			std::clog << "\n";
+			if (!heatmap_file.empty()) write_heatmap(pixel_cost);
+			if (stop_requested) {
+				std::clog << "Interrupted: " << image.total_samples() << " samples saved to '" << checkpoint_file << "', continue with --resume.\n";
+			}
+			if (converged) {
+				std::clog << "All pixels below the adaptive noise threshold of " << std::setprecision(3) << adaptive_threshold << ".\n";
+			} else if (!stop_requested && target_error > 0 && error <= target_error) {
+				std::clog << "Noise target of " << std::setprecision(3) << target_error << " reached.\n";
+			} else if (!stop_requested && time_budget > 0 && done_samples < end_sample) {
+				std::clog << "Time budget of " << std::setprecision(1) << time_budget << " s reached.\n";
+			}
+
+			auto [fewest, most] = std::minmax_element(image.samples.begin(), image.samples.end());
+			std::clog << "Rendered " << pass_number << " passes in " << std::setprecision(1) << elapsed() << " s: "
+					  << std::setprecision(2) << double(image.total_samples()) / image.pixel_count() << " samples per pixel ("
+					  << *fewest << " to " << *most << "), relative error " << std::setprecision(4) << image.relative_rms_error() << ".\n";
+
+			double render_seconds = elapsed();
+			counters = render_counters();
+			for (const auto& c : worker_counters) counters.merge(c);
+			if (counters.paths() > 0) {
+				std::clog << "Average path length: " << std::setprecision(3) << double(counters.rays()) / counters.paths()
+						  << " segments over " << counters.paths() << " paths (max depth " << max_depth << "), "
+						  << counters.rays() / render_seconds / 1e6 << " Mrays/s.\n";
+			}
+			if (!stats_file.empty()) write_stats(image, worker_counters, render_seconds);
 
 			std::clog << "\rDone.\n";
+			return image;
+		}
+
+		// Bytes of the per-pixel render state: the film's sums and counts and the pass targets.
+		size_t framebuffer_bytes() const {
+			size_t pixels = size_t(image_width) * std::max(1, int(image_width / aspect_ratio));
+			return pixels * (sizeof(color) + sizeof(double) + 2 * sizeof(uint32_t));
+		}
+
+		// Trace one camera ray per pixel, packet_size rays at a time, without shading. Returns the
+		// number of rays that hit something. Used to measure primary-ray traversal throughput.
+		long long trace_primary_rays(const intersectable& world) {
+			initialize();
+
+			auto smp = make_sampler();
+			sampler_scope scope(*smp);
+			ray_packet packet;
+			intersects hits[ray_packet::max_size];
+			int block_width, block_height;
+			packet_shape(block_width, block_height);
+			long long found = 0;
+
+			for (int by = 0; by < image_height; by += block_height) {
+				for (int bx = 0; bx < image_width; bx += block_width) {
+					int bw = std::min(block_width, image_width - bx);
+					int bh = std::min(block_height, image_height - by);
+
+					if (bw * bh == 1) {
+						intersects inte;
+						smp->start_pixel_sample(sample_pixel(bx, by), 0);
+						found += world.intersect(get_ray(bx, by, *smp), interval(0.001, infinity), inte);
+						continue;
+					}
+
+					int xs[ray_packet::max_size], ys[ray_packet::max_size], samples[ray_packet::max_size] = {};
+					for (int lane = 0; lane < bw * bh; ++lane) {
+						xs[lane] = bx + lane % bw;
+						ys[lane] = by + lane / bw;
+					}
+					trace_camera_packet(xs, ys, samples, bw * bh, world, *smp, packet, hits);
+					for (int lane = 0; lane < packet.size; ++lane) found += packet.hit[lane];
+				}
+			}
+
+			return found;
 		}
 
 	private:
@@ -79,7 +378,6 @@ class camera {
 		point3d first_pixel_loc; // Location of 0,0
 		vec3d pixel_delta_u;
 		vec3d pixel_delta_v;
-		double pixel_samples_scale; // Color scale factor by pixel samples.
 		vec3d u, v, w; // Camera frame basis vectors
 		vec3d defocus_disk_u;
 		vec3d defocus_disk_v;
@@ -88,8 +386,6 @@ class camera {
 			image_height = int(image_width / aspect_ratio);
 			image_height = (image_height < 1) ? 1 : image_height;
 
-			pixel_samples_scale = 1.0 / random_samples_per_pixel;
-
 			camera_center = look_from;
 
 			// Calculate viewport dimensions
@@ -122,45 +418,675 @@ class camera {
 			defocus_disk_v = v * defocus_radius;
 		}
 
-		ray get_ray(int i, int j) const {
+		// Bring every pixel p of the tile up to target[p] samples, adding samples
+		// [image.samples[p], target[p]) to the film. With a cost array, what the samples of pixel p
+		// cost by heatmap_metric is added to cost[p].
+		void render_tile(const tile& t, const std::vector<uint32_t>& target, const intersectable& world, film& image, double* cost = nullptr) const {
+			if (mode == render_mode::wavefront) {
+				render_tile_wavefront(t, target, world, image, cost);
+				return;
+			}
+
+			auto smp = make_sampler();
+			sampler_scope scope(*smp);
+
+			int block_width, block_height;
+			packet_shape(block_width, block_height);
+
+			if (block_width * block_height == 1) {
+				for (int j = t.y0; j < t.y1; ++j) {
+					for (int i = t.x0; i < t.x1; ++i) {
+						int p = j * image_width + i;
+						double before = cost ? current_cost(heatmap_metric) : 0;
+						for (int sample = int(image.samples[p]); sample < int(target[p]); ++sample) {
+							// Seeding from the sample's identity makes it independent of the thread and tile order.
+							seed_thread_rng(p, sample, frame);
+							smp->start_pixel_sample(sample_pixel(i, j), sample);
+							ray r = get_ray(i, j, *smp);
+							thread_recorder.begin_sample(p, sample);
+							int path_length = 0;
+							image.add(p, ray_color(r, world, *smp, path_length));
+							thread_counters.add_path(path_length);
+						}
+						if (cost) cost[p] += current_cost(heatmap_metric) - before;
+						image.samples[p] = std::max(image.samples[p], target[p]);
+					}
+				}
+			} else {
+				// Camera rays of a block of neighbouring pixels are traced as one packet, then each
+				// path carries on by itself from its first hit. Pixels of the block may be at
+				// different sample indices; those with all their samples drop out of the packet.
+				ray_packet packet;
+				intersects hits[ray_packet::max_size];
+				int xs[ray_packet::max_size], ys[ray_packet::max_size], samples[ray_packet::max_size];
+
+				for (int by = t.y0; by < t.y1; by += block_height) {
+					for (int bx = t.x0; bx < t.x1; bx += block_width) {
+						int bw = std::min(block_width, t.x1 - bx);
+						int bh = std::min(block_height, t.y1 - by);
+
+						while (true) {
+							int count = 0;
+							for (int k = 0; k < bw * bh; ++k) {
+								int i = bx + k % bw;
+								int j = by + k / bw;
+								int p = j * image_width + i;
+								if (image.samples[p] >= target[p]) continue;
+								xs[count] = i;
+								ys[count] = j;
+								samples[count] = int(image.samples[p]++);
+								count++;
+							}
+							if (count == 0) break;
+
+							// The packet's cost is shared evenly by its pixels. A node the packet visits
+							// counts once for all of its lanes, so packet heatmaps of BVH nodes read lower
+							// than wavefront or scalar ones and only compare with other packet renders.
+							double before = cost ? current_cost(heatmap_metric) : 0;
+							trace_camera_packet(xs, ys, samples, count, world, *smp, packet, hits);
+							double packet_share = cost ? (current_cost(heatmap_metric) - before) / count : 0;
+
+							for (int lane = 0; lane < count; ++lane) {
+								int p = ys[lane] * image_width + xs[lane];
+								if (cost) before = current_cost(heatmap_metric);
+								seed_thread_rng(p, samples[lane], frame);
+								smp->start_pixel_sample(packet.pixel[lane], samples[lane], packet.dimension[lane]);
+								primary_hit first{packet.hit[lane], &hits[lane]};
+								thread_recorder.begin_sample(p, samples[lane]);
+								int path_length = 0;
+								image.add(p, ray_color(packet.rays[lane], world, *smp, path_length, &first));
+								thread_counters.add_path(path_length);
+								if (cost) cost[p] += packet_share + current_cost(heatmap_metric) - before;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		// Structure-of-arrays state of a batch of paths in flight.
+		struct path_batch {
+			std::vector<double> origin_x, origin_y, origin_z;
+			std::vector<double> direction_x, direction_y, direction_z;
+			std::vector<double> time;
+			std::vector<double> throughput_r, throughput_g, throughput_b;
+			std::vector<double> radiance_r, radiance_g, radiance_b; // Gathered so far by each path
+			std::vector<int> pixel, sample, bounce, dimension;
+			std::vector<char> hit;
+			std::vector<intersects> hits;
+
+			path_batch(size_t lanes)
+			  : origin_x(lanes), origin_y(lanes), origin_z(lanes),
+				direction_x(lanes), direction_y(lanes), direction_z(lanes), time(lanes),
+				throughput_r(lanes), throughput_g(lanes), throughput_b(lanes),
+				radiance_r(lanes), radiance_g(lanes), radiance_b(lanes),
+				pixel(lanes), sample(lanes), bounce(lanes), dimension(lanes), hit(lanes), hits(lanes)
+			{}
+
+			ray get_ray(int lane) const {
+				return ray(point3d(origin_x[lane], origin_y[lane], origin_z[lane]),
+						   vec3d(direction_x[lane], direction_y[lane], direction_z[lane]), time[lane]);
+			}
+
+			void set_ray(int lane, const ray& r) {
+				origin_x[lane] = r.origin().x();
+				origin_y[lane] = r.origin().y();
+				origin_z[lane] = r.origin().z();
+				direction_x[lane] = r.direction().x();
+				direction_y[lane] = r.direction().y();
+				direction_z[lane] = r.direction().z();
+				time[lane] = r.time();
+			}
+
+			color throughput(int lane) const {
+				return color(throughput_r[lane], throughput_g[lane], throughput_b[lane]);
+			}
+
+			void set_throughput(int lane, const color& c) {
+				throughput_r[lane] = c.x();
+				throughput_g[lane] = c.y();
+				throughput_b[lane] = c.z();
+			}
+
+			color radiance(int lane) const {
+				return color(radiance_r[lane], radiance_g[lane], radiance_b[lane]);
+			}
+
+			void add_radiance(int lane, const color& c) {
+				radiance_r[lane] += c.x();
+				radiance_g[lane] += c.y();
+				radiance_b[lane] += c.z();
+			}
+		};
+
+		// Wavefront version of render_tile. Every iteration intersects all live paths, bins the hits
+		// into one queue per material kind, then shades the queues one after another. Lanes whose
+		// path ended are refilled with the tile's next camera samples. Gives the same estimate as
+		// ray_color for every sample, just in a different order.
+		void render_tile_wavefront(const tile& t, const std::vector<uint32_t>& target, const intersectable& world, film& image, double* cost) const {
+			auto smp = make_sampler();
+			sampler_scope scope(*smp);
+
+			int tile_width = t.x1 - t.x0;
+			auto tile_pixel = [&](int local) {
+				return (t.y0 + local / tile_width) * image_width + t.x0 + local % tile_width;
+			};
+
+			long long total_items = 0;
+			for (int local = 0; local < t.pixel_count(); ++local) {
+				int p = tile_pixel(local);
+				if (target[p] > image.samples[p]) total_items += target[p] - image.samples[p];
+			}
+			if (total_items <= 0) return;
+
+			int lanes = int(std::min<long long>(std::max(1, wavefront_batch), total_items));
+			path_batch batch(lanes);
+
+			std::vector<int> free_lanes(lanes);
+			for (int lane = 0; lane < lanes; ++lane) free_lanes[lane] = lanes - 1 - lane;
+			std::vector<int> active, next_active;
+			std::vector<int> queues[int(material_kind::other) + 1];
+
+			int next_local = 0;
+
+			auto sample_pixel = [&](int lane) {
+				return uint64_t(frame) * image_width * image_height + batch.pixel[lane];
+			};
+
+			while (true) {
+				// Refill idle lanes with new camera samples, one pixel's remaining samples after another.
+				while (!free_lanes.empty() && next_local < t.pixel_count()) {
+					int p = tile_pixel(next_local);
+					if (image.samples[p] >= target[p]) {
+						next_local++;
+						continue;
+					}
+
+					int lane = free_lanes.back();
+					free_lanes.pop_back();
+
+					int sample = int(image.samples[p]++);
+					batch.pixel[lane] = p;
+					batch.sample[lane] = sample;
+					batch.bounce[lane] = 0;
+					batch.set_throughput(lane, color(1, 1, 1));
+					batch.radiance_r[lane] = batch.radiance_g[lane] = batch.radiance_b[lane] = 0;
+
+					seed_thread_rng(p, sample, frame);
+					smp->start_pixel_sample(sample_pixel(lane), sample);
+					batch.set_ray(lane, get_ray(p % image_width, p / image_width, *smp));
+					active.push_back(lane);
+				}
+
+				if (active.empty()) break;
+
+				// Extension rays for every live path.
+				for (int lane : active) {
+					double before = cost ? current_cost(heatmap_metric) : 0;
+					smp->start_pixel_sample(sample_pixel(lane), batch.sample[lane], camera_dimensions + batch.bounce[lane] * dimensions_per_bounce);
+					batch.hit[lane] = world.intersect(batch.get_ray(lane), interval(0.001, infinity), batch.hits[lane]);
+					if (cost) cost[batch.pixel[lane]] += current_cost(heatmap_metric) - before;
+					batch.dimension[lane] = smp->current_dimension();
+					if (thread_recorder.captures(batch.pixel[lane])) {
+						thread_recorder.record(batch.pixel[lane], batch.sample[lane], batch.bounce[lane], batch.get_ray(lane),
+											   interval(0.001, infinity), batch.hit[lane], batch.hit[lane] ? batch.hits[lane].t : infinity);
+					}
+				}
+
+				// Misses pick up the background and end; hits are binned by material.
+				for (auto& q : queues) q.clear();
+				for (int lane : active) {
+					if (!batch.hit[lane]) {
+						batch.add_radiance(lane, batch.throughput(lane) * background);
+						image.add(batch.pixel[lane], batch.radiance(lane));
+						thread_counters.add_path(batch.bounce[lane] + 1);
+						free_lanes.push_back(lane);
+					} else {
+						int kind = int(batch.hits[lane].mat->kind());
+						thread_counters.material_hits[kind]++;
+						queues[kind].push_back(lane);
+					}
+				}
+
+				next_active.clear();
+				for (auto& q : queues) {
+					for (int lane : q) {
+						double before = cost ? current_cost(heatmap_metric) : 0;
+						bool alive = shade_lane(batch, lane, *smp, sample_pixel(lane));
+						if (cost) cost[batch.pixel[lane]] += current_cost(heatmap_metric) - before;
+						if (alive) {
+							next_active.push_back(lane);
+						} else {
+							image.add(batch.pixel[lane], batch.radiance(lane));
+							thread_counters.add_path(batch.bounce[lane] + 1);
+							free_lanes.push_back(lane);
+						}
+					}
+				}
+				active.swap(next_active);
+			}
+		}
+
+		// One bounce of ray_color for a lane that hit something. Returns false when the path ends.
+		bool shade_lane(path_batch& batch, int lane, sampler& smp, uint64_t pixel) const {
+			const intersects& inte = batch.hits[lane];
+			int bounce = batch.bounce[lane];
+			color throughput = batch.throughput(lane);
+
+			batch.add_radiance(lane, throughput * inte.mat->emitted(inte.u, inte.v, inte.p));
+
+			smp.start_pixel_sample(pixel, batch.sample[lane], batch.dimension[lane]);
+			ray scattered;
+			color attenuation;
+			if (!inte.mat->scatter(batch.get_ray(lane), inte, attenuation, scattered)) return false;
+
+			throughput = throughput * attenuation;
+			double max_throughput = std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z()));
+			if (max_throughput <= 0 || bounce + 1 >= max_depth) return false;
+
+			if (russian_roulette_depth > 0 && bounce + 1 >= russian_roulette_depth && max_throughput < 1) {
+				smp.set_dimension(camera_dimensions + bounce * dimensions_per_bounce + dimensions_per_bounce - 1);
+				if (smp.get_1d() >= max_throughput) return false;
+				throughput /= max_throughput;
+			}
+
+			batch.set_throughput(lane, throughput);
+			batch.set_ray(lane, scattered);
+			batch.bounce[lane] = bounce + 1;
+			return true;
+		}
+
+		std::unique_ptr<sampler> make_sampler() const {
+			switch (sampling) {
+				case sampler_type::independent: return std::make_unique<independent_sampler>();
+				case sampler_type::stratified: return std::make_unique<stratified_sampler>(random_samples_per_pixel);
+				default: return std::make_unique<sobol_sampler>();
+			}
+		}
+
+		// Index of pixel (i, j) of this frame as seen by the sampler.
+		uint64_t sample_pixel(int i, int j) const {
+			return uint64_t(frame) * image_width * image_height + j * image_width + i;
+		}
+
+		// Pixel block covered by one packet: 2x2, 4x2 or 4x4.
+		void packet_shape(int& width, int& height) const {
+			int size = 1;
+			while (size * 2 <= std::min(packet_size, ray_packet::max_size)) size *= 2;
+			int log2 = 0;
+			while ((1 << log2) < size) log2++;
+			width = 1 << ((log2 + 1) / 2);
+			height = size / width;
+		}
+
+		// Generate the camera rays of sample samples[k] of pixel (xs[k], ys[k]) for count pixels and
+		// trace them as a packet. Each lane's sampler position after the camera ray is kept in the packet.
+		void trace_camera_packet(const int* xs, const int* ys, const int* samples, int count, const intersectable& world, sampler& smp, ray_packet& packet, intersects* hits) const {
+			packet.size = count;
+			packet.smp = &smp;
+
+			for (int lane = 0; lane < count; ++lane) {
+				packet.pixel[lane] = sample_pixel(xs[lane], ys[lane]);
+				packet.sample[lane] = samples[lane];
+				smp.start_pixel_sample(packet.pixel[lane], samples[lane]);
+				packet.set_ray(lane, get_ray(xs[lane], ys[lane], smp));
+				packet.dimension[lane] = camera_dimensions;
+				packet.t_min[lane] = 0.001;
+				packet.t_max[lane] = infinity;
+				packet.hit[lane] = false;
+			}
+
+			world.intersect_packet(packet, hits, packet.all_lanes());
+		}
+
+		// Fingerprint of everything that changes the samples: the camera settings except the sample
+		// count, the world's bounds and what a grid of probe rays through pixel centres hits. Stored
+		// with checkpoints so a resume can't mix scenes.
+		uint64_t scene_hash(const intersectable& world) const {
+			aabb bounds = world.bounding_box();
+			fingerprint f;
+			f.add(aspect_ratio).add(image_width).add(max_depth).add(background).add(vfov);
+			f.add(look_from).add(look_at).add(vup).add(defocus_angle).add(focus_dist);
+			f.add(frame).add(sampling).add(russian_roulette_depth);
+			f.add(bounds.x.min).add(bounds.x.max).add(bounds.y.min).add(bounds.y.max).add(bounds.z.min).add(bounds.z.max);
+
+			seed_thread_rng(0, 0, 0); // Media draw random distances while intersecting
+			for (int k = 0; k < 64; ++k) {
+				double i = (k % 8 + 0.5) * image_width / 8;
+				double j = (k / 8 + 0.5) * image_height / 8;
+				ray r(camera_center, first_pixel_loc + i * pixel_delta_u + j * pixel_delta_v - camera_center);
+				intersects inte;
+				if (world.intersect(r, interval(0.001, infinity), inte)) f.add(inte.t).add(inte.mat->kind());
+				else f.add(-1.0);
+			}
+			return f.value();
+		}
+
+		// Sample count every pixel is brought to by the next pass, given the count all pixels have
+		// reached. Without a budget or noise target, that is all samples at once, or samples_per_pass
+		// at a time when checkpointing. Progressive renders double the samples every pass so that
+		// each pass costs about as much as all before it, but stop short of what is left of the time
+		// budget and of the samples the noise target is expected to need.
+		int next_pass_target(int done, int begin, int end, bool pilot, double elapsed, double seconds_per_sample, double error) const {
+			if (pilot) return begin + pilot_samples_per_pixel;
+
+			bool progressive = time_budget > 0 || target_error > 0;
+			if (!progressive && !adaptive) return std::min(end, checkpoint_file.empty() ? end : done + std::max(1, samples_per_pass));
+
+			int rendered = done - begin;
+			if (adaptive && rendered < adaptive_base_samples) return std::min(end, begin + std::max(1, adaptive_base_samples));
+			if (target_error > 0 && rendered > 1 && error <= target_error) return done;
+
+			double increment = std::max(1, rendered);
+			if (!checkpoint_file.empty()) increment = std::min(increment, double(std::max(1, samples_per_pass)));
+			if (time_budget > 0 && seconds_per_sample > 0) {
+				increment = std::min(increment, std::floor((time_budget - elapsed) / seconds_per_sample));
+				if (increment < 1) return done;
+			}
+			if (target_error > 0 && rendered > 1 && error > 0) {
+				double needed = done * (error / target_error) * (error / target_error) - done;
+				increment = std::min(increment, std::max(1.0, std::ceil(needed)));
+			}
+			return int(std::min<double>(end, done + increment));
+		}
+
+		// Lower the targets of pixels whose relative error is at most adaptive_threshold to the samples
+		// they already have. The worst error of the 3x3 neighbourhood is used, so a pixel whose samples
+		// have all missed a small light so far isn't taken for converged next to one that found it.
+		// Returns the number of pixels that will still get samples.
+		size_t restrict_to_noisy_pixels(const film& image, std::vector<uint32_t>& target) const {
+			std::vector<double> error(image.pixel_count());
+			#pragma omp parallel for
+			for (int p = 0; p < int(image.pixel_count()); ++p) error[p] = image.relative_error(p);
+
+			size_t active = 0;
+			for (int j = 0; j < image_height; ++j) {
+				for (int i = 0; i < image_width; ++i) {
+					double worst = 0;
+					for (int y = std::max(0, j - 1); y <= std::min(image_height - 1, j + 1); ++y) {
+						for (int x = std::max(0, i - 1); x <= std::min(image_width - 1, i + 1); ++x) {
+							worst = std::max(worst, error[y * image_width + x]);
+						}
+					}
+
+					int p = j * image_width + i;
+					if (worst <= adaptive_threshold) target[p] = std::min(target[p], image.samples[p]);
+					else if (target[p] > image.samples[p]) active++;
+				}
+			}
+			return active;
+		}
+
+		// JSON report of the render: settings, timings, ray throughput and the summed counters, with
+		// the rays of each worker to show how evenly the work was spread.
+		void write_stats(const film& image, const std::vector<render_counters>& workers, double render_seconds) const {
+			std::ofstream out(stats_file);
+			if (!out) {
+				std::cerr << "ERROR: Could not open stats file '" << stats_file << "'.\n";
+				return;
+			}
+
+			auto list = [&](const long long* values, int count) {
+				out << "[";
+				for (int k = 0; k < count; ++k) out << (k ? ", " : "") << values[k];
+				out << "]";
+			};
+
+			out << std::setprecision(6);
+			out << "{\n";
+			out << "  \"scene\": \"" << scene_name << "\",\n";
+			out << "  \"width\": " << image_width << ",\n";
+			out << "  \"height\": " << image_height << ",\n";
+			out << "  \"samples_per_pixel\": " << double(image.total_samples()) / image.pixel_count() << ",\n";
+			out << "  \"threads\": " << threads << ",\n";
+			out << "  \"mode\": \"" << (mode == render_mode::wavefront ? "wavefront" : "path") << "\",\n";
+			out << "  \"packet_size\": " << packet_size << ",\n";
+			out << "  \"max_depth\": " << max_depth << ",\n";
+			out << "  \"build_seconds\": " << build_seconds << ",\n";
+			out << "  \"bvh_build_seconds\": " << bvh_build_seconds << ",\n";
+			out << "  \"render_seconds\": " << render_seconds << ",\n";
+			out << "  \"total_seconds\": " << build_seconds + render_seconds << ",\n";
+			out << "  \"mrays_per_second\": " << counters.rays() / render_seconds / 1e6 << ",\n";
+			out << "  \"camera_rays\": " << counters.camera_rays << ",\n";
+			out << "  \"secondary_rays\": " << counters.secondary_rays << ",\n";
+			out << "  \"bvh_nodes_visited\": " << counters.bvh_nodes << ",\n";
+			out << "  \"box_tests\": " << counters.box_tests << ",\n";
+			out << "  \"primitive_tests\": {\"triangle\": " << counters.triangle_tests << ", \"sphere\": " << counters.sphere_tests
+				<< ", \"quadrilateral\": " << counters.quad_tests << "},\n";
+			out << "  \"material_hits\": {";
+			for (int k = 0; k < render_counters::material_kinds; ++k) {
+				out << (k ? ", " : "") << "\"" << material_kind_name(material_kind(k)) << "\": " << counters.material_hits[k];
+			}
+			out << "},\n";
+			out << "  \"path_lengths\": ";
+			list(counters.path_lengths, render_counters::path_length_bins);
+			out << ",\n";
+			std::vector<long long> worker_rays;
+			for (const auto& c : workers) worker_rays.push_back(c.rays());
+			out << "  \"worker_rays\": ";
+			list(worker_rays.data(), int(worker_rays.size()));
+			out << "\n}\n";
+		}
+
+		void save_captured_rays(const intersectable& world, const std::vector<std::vector<captured_ray>>& workers) const {
+			std::vector<captured_ray> rays;
+			for (const auto& w : workers) rays.insert(rays.end(), w.begin(), w.end());
+			if (!save_ray_capture(ray_capture_file, world.bounding_box(), std::move(rays))) {
+				std::cerr << "ERROR: Could not write ray capture file '" << ray_capture_file << "'.\n";
+			}
+		}
+
+		// Write the samples taken in every pixel as an image: raw counts for PFM, otherwise scaled so
+		// the most sampled pixel is white.
+		void write_sample_map(const film& image) const {
+			std::ofstream out(sample_map_file, std::ios::binary);
+			if (!out) {
+				std::cerr << "ERROR: Could not open sample map file '" << sample_map_file << "'.\n";
+				return;
+			}
+
+			image_format format = image_format_for_file(sample_map_file, image_format::png);
+			uint32_t most = std::max<uint32_t>(1, *std::max_element(image.samples.begin(), image.samples.end()));
+			double scale = format == image_format::pfm ? 1.0 : 1.0 / most;
+
+			std::vector<color> pixels(image.pixel_count());
+			for (size_t p = 0; p < pixels.size(); ++p) {
+				double v = image.samples[p] * scale;
+				pixels[p] = color(v, v, v);
+			}
+			write_image(out, format, image_width, image_height, pixels);
+		}
+
+		// Pixel costs in false colour, from blue for none to red for the 99th percentile and above so
+		// that a few outliers don't wash out the rest. PFM gets the raw costs.
+		void write_heatmap(const std::vector<double>& cost) const {
+			double total = 0;
+			for (double c : cost) total += c;
+			if (total == 0) {
+				std::cerr << "WARNING: No " << cost_metric_name(heatmap_metric) << " were counted in any pixel (a scene without a BVH"
+						  << " visits no nodes), so no heatmap was written. Try --heatmap-metric tests or time." << std::endl;
+				return;
+			}
+
+			std::ofstream out(heatmap_file, std::ios::binary);
+			if (!out) {
+				std::cerr << "ERROR: Could not open heatmap file '" << heatmap_file << "'.\n";
+				return;
+			}
+
+			std::vector<double> sorted = cost;
+			size_t rank = std::min(sorted.size() - 1, sorted.size() * 99 / 100);
+			std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+			double high = std::max(sorted[rank], 1e-9);
+
+			image_format format = image_format_for_file(heatmap_file, image_format::png);
+			std::vector<color> pixels(cost.size());
+			for (size_t p = 0; p < pixels.size(); ++p) {
+				pixels[p] = format == image_format::pfm ? color(cost[p], cost[p], cost[p]) : heat_color(cost[p] / high);
+			}
+			write_image(out, format, image_width, image_height, pixels);
+
+			std::clog << "Heatmap of " << cost_metric_name(heatmap_metric) << " per pixel: mean " << std::setprecision(1)
+					  << total / cost.size() << ", red at " << high << ".\n";
+		}
+
+		// The render region, clipped to the image, and the samples [first, last) taken in it.
+		film_slice slice(int first, int last) const {
+			film_slice s;
+			s.first_sample = first;
+			s.last_sample = last;
+			s.x0 = std::clamp(region_x0, 0, image_width);
+			s.y0 = std::clamp(region_y0, 0, image_height);
+			s.x1 = region_x1 < 0 ? image_width : std::clamp(region_x1, s.x0, image_width);
+			s.y1 = region_y1 < 0 ? image_height : std::clamp(region_y1, s.y0, image_height);
+			return s;
+		}
+
+		// The tiles covering the render region, clipped to it.
+		std::vector<tile> region_tiles() const {
+			film_slice region = slice(0, 0);
+
+			std::vector<tile> tiles;
+			for (tile t : make_tiles(image_width, image_height, tile_size)) {
+				t.x0 = std::max(t.x0, region.x0);
+				t.y0 = std::max(t.y0, region.y0);
+				t.x1 = std::min(t.x1, region.x1);
+				t.y1 = std::min(t.y1, region.y1);
+				if (t.x0 < t.x1 && t.y0 < t.y1) tiles.push_back(t);
+			}
+			return tiles;
+		}
+
+		// Save the samples this process rendered, with the region and sample indices they cover so
+		// that merge can refuse to count the same samples twice. The counts are made relative to the
+		// start of the sample slice so that merging partials adds up to the samples actually taken.
+		void save_partial(film image, uint64_t hash, int begin_sample) const {
+			uint32_t end_sample = uint32_t(begin_sample);
+			for (auto& n : image.samples) {
+				end_sample = std::max(end_sample, n);
+				n = n > uint32_t(begin_sample) ? n - uint32_t(begin_sample) : 0;
+			}
+			if (!image.save(partial_file, hash, tile_size, slice(begin_sample, int(end_sample)))) {
+				std::cerr << "\nERROR: Could not write partial render '" << partial_file << "'.\n";
+			}
+		}
+
+		void save_checkpoint(const film& image, uint64_t hash) const {
+			uint32_t end_sample = 0;
+			for (auto n : image.samples) end_sample = std::max(end_sample, n);
+			if (!image.save(checkpoint_file, hash, tile_size, slice(std::max(first_sample, 0), int(end_sample)))) {
+				std::cerr << "\nERROR: Could not write checkpoint '" << checkpoint_file << "'.\n";
+			}
+		}
+
+		// Continue from the samples saved in checkpoint_file. Fails if the checkpoint was made with
+		// another scene, camera or image size.
+		bool load_checkpoint(film& image, uint64_t hash) {
+			film saved;
+			uint64_t saved_hash;
+			int saved_tile_size;
+			film_slice saved_slice;
+			if (!saved.load(checkpoint_file, saved_hash, saved_tile_size, saved_slice)) {
+				std::cerr << "ERROR: Could not read checkpoint '" << checkpoint_file << "'.\n";
+				return false;
+			}
+			if (saved_hash != hash || saved.width != image_width || saved.height != image_height) {
+				std::cerr << "ERROR: Checkpoint '" << checkpoint_file << "' was rendered from a different scene or camera.\n";
+				return false;
+			}
+
+			image = std::move(saved);
+			if (saved_tile_size > 0) tile_size = saved_tile_size;
+			std::clog << "Resuming from '" << checkpoint_file << "' with " << image.total_samples() << " samples.\n";
+			return true;
+		}
+
+		static inline volatile std::sig_atomic_t stop_requested = 0;
+
+		static void request_stop(int) {
+			stop_requested = 1;
+		}
+
+		// Sampler dimensions: 0-1 pixel offset, 2-3 lens, 4 time, then a fixed block per bounce.
+		static constexpr int camera_dimensions = 5;
+		static constexpr int dimensions_per_bounce = 4;
+
+		ray get_ray(int i, int j, sampler& smp) const {
 			// Camera ray from the defocus disk directed to a random sample around the pixel at i, j.
-			auto offset = sample_square();
-			auto pixel_sample = first_pixel_loc + ((i + offset.x()) * pixel_delta_u) + ((j + offset.y()) * pixel_delta_v);
+			auto offset = smp.get_2d();
+			auto pixel_sample = first_pixel_loc + ((i + offset.u - 0.5) * pixel_delta_u) + ((j + offset.v - 0.5) * pixel_delta_v);
 
-			auto ray_origin = (defocus_angle <= 0) ? camera_center : defocus_disk_sample();
+			auto lens = smp.get_2d();
+			auto ray_origin = (defocus_angle <= 0) ? camera_center : defocus_disk_sample(lens);
 			auto ray_direction = pixel_sample - ray_origin;
-			auto ray_time = random_double();
+			auto ray_time = smp.get_1d();
 
 			return ray(ray_origin, ray_direction, ray_time);
 		}
 
-		// Returns a vector to a random point in the .5 unit square.
-		vec3d sample_square() const {
-			return vec3d(random_double() - 0.5, random_double() - 0.5, 0);
-		}
+		// The camera ray's intersection, when it was already traced as part of a packet.
+		struct primary_hit {
+			bool found;
+			const intersects* inte;
+		};
 
-		color ray_color(const ray& r, int depth, const intersectable& world) const {
-			// Limit bounces by depth recursion.
-			if (depth <= 0) return color(0, 0, 0);
+		// Iterative path tracer. Carries the path throughput so the stack use is fixed, and after
+		// russian_roulette_depth bounces terminates paths with probability 1 - max(throughput),
+		// reweighting the survivors to stay unbiased. path_length is set to the segments traced.
+		color ray_color(const ray& r, const intersectable& world, sampler& smp, int& path_length, const primary_hit* first = nullptr) const {
+			color radiance(0, 0, 0);
+			color throughput(1, 1, 1);
+			ray current = r;
 
-			intersects inte;
+			for (int bounce = 0; bounce < max_depth; ++bounce) {
+				int dimension = camera_dimensions + bounce * dimensions_per_bounce;
+				path_length = bounce + 1;
 
-			if (!world.intersect(r, interval(0.001, infinity), inte)) return background;
+				intersects inte;
+				bool found;
 
-			ray scattered;
-			color attenuation;
-			color color_from_emission = inte.mat->emitted(inte.u, inte.v, inte.p);
+				if (bounce == 0 && first) {
+					// The sampler is already positioned after whatever the packet traversal drew.
+					found = first->found;
+					if (found) inte = *first->inte;
+				} else {
+					smp.set_dimension(dimension);
+					found = world.intersect(current, interval(0.001, infinity), inte);
+				}
+				if (thread_recorder.active) thread_recorder.record(bounce, current, interval(0.001, infinity), found, found ? inte.t : infinity);
 
-			if (!inte.mat->scatter(r, inte, attenuation, scattered)) return color_from_emission;
+				if (!found) {
+					radiance += throughput * background;
+					break;
+				}
 
-			color color_from_scatter = attenuation * ray_color(scattered, depth-1, world);
+				thread_counters.material_hits[int(inte.mat->kind())]++;
+				radiance += throughput * inte.mat->emitted(inte.u, inte.v, inte.p);
+
+				ray scattered;
+				color attenuation;
+				if (!inte.mat->scatter(current, inte, attenuation, scattered)) break;
+
+				throughput = throughput * attenuation;
+				double max_throughput = std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z()));
+				if (max_throughput <= 0) break;
+
+				if (russian_roulette_depth > 0 && bounce + 1 >= russian_roulette_depth && max_throughput < 1) {
+					// The last dimension of the bounce block is reserved for the roulette decision.
+					smp.set_dimension(dimension + dimensions_per_bounce - 1);
+					if (smp.get_1d() >= max_throughput) break;
+					throughput /= max_throughput;
+				}
+
+				current = scattered;
+			}
 
-			return color_from_emission + color_from_scatter;
+			return radiance;
 		}
 
-		// Returns a random point in the camera defocus disk
-		point3d defocus_disk_sample() const {
-		auto p = random_in_unit_disk();
+		// Returns the point in the camera defocus disk for a lens sample
+		point3d defocus_disk_sample(const sample2d& lens) const {
+		auto p = sample_in_unit_disk(lens.u, lens.v);
 		return camera_center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
 	}
 };
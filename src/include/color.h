@@ -7,26 +7,36 @@
 // Alias
 using color = vec3d;
 
+// Rec. 709 relative luminance of linear RGB.
+inline double luminance(const color& c) {
+	return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
 inline double linear_to_gamma(double linear_component) {
 	if (linear_component > 0) return std::sqrt(linear_component);
 	return 0;
 }
 
-void write_color(std::ostream& output, const color& pixel_color) {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
-
-	// Apply a linear to gamma transform.
-	r = linear_to_gamma(r);
-	g = linear_to_gamma(g);
-	b = linear_to_gamma(b);
+// False colour for v in [0, 1], running blue, cyan, green, yellow, red. Linear, so that it shows
+// as these colours once gamma encoded.
+inline color heat_color(double v) {
+	static const color stops[] = {color(0, 0, 1), color(0, 1, 1), color(0, 1, 0), color(1, 1, 0), color(1, 0, 0)};
+	double x = std::fmin(std::fmax(v, 0.0), 1.0) * 4;
+	int k = std::min(int(x), 3);
+	color c = stops[k] + (x - k) * (stops[k + 1] - stops[k]);
+	return c * c;
+}
 
-	// Scaled values to the range [0, 255].
+// Apply a linear to gamma transform and scale to the range [0, 255].
+inline int to_byte(double linear_component) {
 	static const interval intensity(0.000, 0.999);
-    int scaled_r = int(256 * intensity.clamp(r));
-    int scaled_g = int(256 * intensity.clamp(g));
-    int scaled_b = int(256 * intensity.clamp(b));
+	return int(256 * intensity.clamp(linear_to_gamma(linear_component)));
+}
+
+void write_color(std::ostream& output, const color& pixel_color) {
+    int scaled_r = to_byte(pixel_color.x());
+    int scaled_g = to_byte(pixel_color.y());
+    int scaled_b = to_byte(pixel_color.z());
 
     // Write out the pixel color components.
     output << scaled_r << ' ' << scaled_g << ' ' << scaled_b << '\n';
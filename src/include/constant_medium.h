@@ -32,7 +32,7 @@ class constant_medium : public intersectable {
 
 			auto ray_length = r.direction().length();
 			auto distance_inside_boundary = (inte2.t - inte1.t) * ray_length;
-			auto intersect_distance = neg_inv_density * std::log(random_double());
+			auto intersect_distance = neg_inv_density * std::log(1 - sample_1d());
 
 			if (intersect_distance > distance_inside_boundary) return false;
 
@@ -48,6 +48,14 @@ class constant_medium : public intersectable {
 
 		aabb bounding_box() const override { return boundary->bounding_box(); }
 
+		void refit() override { boundary->refit(); }
+
+		void account_memory(memory_usage& usage) const override {
+			usage.add(memory_usage::primitives, "constant_medium", shared_bytes<constant_medium>());
+			boundary->account(usage);
+			account_material(phase_function.get(), usage);
+		}
+
 	  private:
 		shared_ptr<intersectable> boundary;
 		double neg_inv_density;
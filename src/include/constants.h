@@ -4,7 +4,8 @@
 #include <iostream>
 #include <limits>
 #include <memory>
-#include <random>
+
+#include "rng.h"
 
 // STD
 using std::make_shared;
@@ -20,11 +21,14 @@ inline double degrees_to_radians(double degrees) {
 	return degrees * pi / 180.0;
 }
 
-// Returns a random real number in the range [0, 1).
+// Returns a random real number in the range [0, 1) from the calling thread's generator.
 inline double random_double() {
-	static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-	static std::mt19937 generator;
-	return distribution(generator);
+	return thread_rng().next_double();
+}
+
+// Fills four random reals in the range [0, 1) at once.
+inline void random_double4(double out[4]) {
+	thread_rng4().next_doubles(out);
 }
 
 // Returns a random real in the range [min, max)
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "color.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Which samples of which pixels a partial render holds: sample indices [first_sample,
+// last_sample) of the pixels in columns [x0, x1) and rows [y0, y1). Two partials with the same
+// seeds repeat each other's samples wherever both of these overlap.
+struct film_slice {
+	int32_t first_sample = 0, last_sample = 0;
+	int32_t x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+	bool overlaps(const film_slice& other) const {
+		return first_sample < other.last_sample && other.first_sample < last_sample
+			&& x0 < other.x1 && other.x0 < x1 && y0 < other.y1 && other.y0 < y1;
+	}
+};
+
+// Running per-pixel sums of radiance samples. Pixels are only averaged on output, so samples can be
+// added at any time and the image at any point is a valid progressive result.
+class film {
+	public:
+		int width = 0;
+		int height = 0;
+		std::vector<color> sum; // Sum of the radiance samples of each pixel
+		std::vector<double> sum_squares; // Sum of the squared luminance of the samples of each pixel
+		std::vector<uint32_t> samples; // Number of samples taken in each pixel
+
+		film() {}
+		film(int width, int height)
+		  : width(width), height(height), sum(size_t(width) * height), sum_squares(size_t(width) * height), samples(size_t(width) * height, 0)
+		{}
+
+		size_t pixel_count() const { return sum.size(); }
+
+		// Accumulate one sample of pixel p. The count is kept by the caller.
+		void add(size_t p, const color& radiance) {
+			sum[p] += radiance;
+			double y = luminance(radiance);
+			sum_squares[p] += y * y;
+		}
+
+		// Average radiance of pixel p.
+		color pixel(size_t p) const {
+			return samples[p] > 0 ? sum[p] / double(samples[p]) : color(0, 0, 0);
+		}
+
+		// Variance of pixel p's mean luminance, estimated from its samples.
+		double variance_of_mean(size_t p) const {
+			if (samples[p] < 2) return 0;
+			double n = samples[p];
+			double mean = luminance(sum[p]) / n;
+			return std::fmax(0.0, (sum_squares[p] / n - mean * mean) / (n - 1));
+		}
+
+		// Standard error of pixel p's mean luminance relative to the mean. The mean is floored at
+		// 0.01 so that pixels which are almost black don't count as noisy.
+		double relative_error(size_t p) const {
+			if (samples[p] < 2) return samples[p] == 0 ? 0 : 1;
+			return std::sqrt(variance_of_mean(p)) / std::fmax(luminance(sum[p]) / samples[p], 0.01);
+		}
+
+		// RMS standard error of the pixels relative to the mean luminance of the image. Judged over
+		// the whole image rather than per pixel, since a pixel whose samples have not found a light
+		// yet looks perfectly converged on its own.
+		double relative_rms_error() const {
+			double variance = 0, mean = 0;
+			size_t sampled = 0;
+			for (size_t p = 0; p < pixel_count(); ++p) {
+				if (samples[p] == 0) continue;
+				variance += variance_of_mean(p);
+				mean += luminance(sum[p]) / samples[p];
+				sampled++;
+			}
+			if (sampled == 0 || mean <= 0) return 0;
+			return std::sqrt(variance / sampled) / (mean / sampled);
+		}
+
+		void row(int j, std::vector<color>& out) const {
+			out.resize(width);
+			for (int i = 0; i < width; ++i) out[i] = pixel(size_t(j) * width + i);
+		}
+
+		// Add the samples of another film of the same size.
+		void merge(const film& other) {
+			for (size_t p = 0; p < pixel_count(); ++p) {
+				sum[p] += other.sum[p];
+				sum_squares[p] += other.sum_squares[p];
+				samples[p] += other.samples[p];
+			}
+		}
+
+		long long total_samples() const {
+			long long total = 0;
+			for (auto n : samples) total += n;
+			return total;
+		}
+
+		// Layout of checkpoints and partial renders: magic, width, height, tile size, scene hash and
+		// the slice of the samples held, then the radiance sums (three doubles per pixel), the squared luminance sums (one double
+		// per pixel) and the sample counts (one uint32 per pixel). The samplers are random access by
+		// (pixel, sample index), so the counts are all the sampler state there is.
+		// Written to a temporary file first so a kill mid-write never leaves a torn checkpoint.
+		bool save(const std::string& path, uint64_t scene_hash, int tile_size, const film_slice& slice) const {
+			std::string temp_path = path + ".tmp";
+			{
+				std::ofstream out(temp_path, std::ios::binary);
+				if (!out) return false;
+
+				out.write(checkpoint_magic, sizeof(checkpoint_magic));
+				int32_t dims[3] = {width, height, tile_size};
+				out.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+				out.write(reinterpret_cast<const char*>(&scene_hash), sizeof(scene_hash));
+				out.write(reinterpret_cast<const char*>(&slice), sizeof(slice));
+				out.write(reinterpret_cast<const char*>(sum.data()), std::streamsize(sum.size() * sizeof(color)));
+				out.write(reinterpret_cast<const char*>(sum_squares.data()), std::streamsize(sum_squares.size() * sizeof(double)));
+				out.write(reinterpret_cast<const char*>(samples.data()), std::streamsize(samples.size() * sizeof(uint32_t)));
+				if (!out) return false;
+			}
+			return std::rename(temp_path.c_str(), path.c_str()) == 0;
+		}
+
+		// Read a checkpoint written by save(). Returns false if it can't be read.
+		bool load(const std::string& path, uint64_t& scene_hash, int& tile_size, film_slice& slice) {
+			std::ifstream in(path, std::ios::binary);
+			if (!in) return false;
+
+			char magic[sizeof(checkpoint_magic)];
+			in.read(magic, sizeof(magic));
+			if (!in || std::string(magic, sizeof(magic)) != std::string(checkpoint_magic, sizeof(checkpoint_magic))) return false;
+
+			int32_t dims[3];
+			in.read(reinterpret_cast<char*>(dims), sizeof(dims));
+			in.read(reinterpret_cast<char*>(&scene_hash), sizeof(scene_hash));
+			in.read(reinterpret_cast<char*>(&slice), sizeof(slice));
+			if (!in || dims[0] <= 0 || dims[1] <= 0) return false;
+
+			*this = film(dims[0], dims[1]);
+			tile_size = dims[2];
+			in.read(reinterpret_cast<char*>(sum.data()), std::streamsize(sum.size() * sizeof(color)));
+			in.read(reinterpret_cast<char*>(sum_squares.data()), std::streamsize(sum_squares.size() * sizeof(double)));
+			in.read(reinterpret_cast<char*>(samples.data()), std::streamsize(samples.size() * sizeof(uint32_t)));
+			return bool(in);
+		}
+
+	private:
+		static constexpr char checkpoint_magic[8] = {'R', 'T', 'C', 'K', 'P', 'T', '0', '3'};
+};
+
+// FNV-1a over raw bytes, used to fingerprint the scene and camera settings.
+class fingerprint {
+	public:
+		template <typename T>
+		fingerprint& add(const T& value) {
+			auto bytes = reinterpret_cast<const unsigned char*>(&value);
+			for (size_t i = 0; i < sizeof(T); ++i) {
+				hash ^= bytes[i];
+				hash *= 0x100000001b3ULL;
+			}
+			return *this;
+		}
+
+		uint64_t value() const { return hash; }
+
+	private:
+		uint64_t hash = 0xcbf29ce484222325ULL;
+};
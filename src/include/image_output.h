@@ -0,0 +1,433 @@
+#pragma once
+
+#include "color.h"
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+enum class image_format {
+	p3, // ASCII PPM
+	p6, // Binary PPM
+	pfm, // Linear 32-bit float RGB (HDR)
+	png // 8-bit RGB PNG
+};
+
+// Parse a format name ("p3", "p6"/"ppm", "pfm", "png"). Returns false for an unknown name.
+inline bool parse_image_format(const std::string& name, image_format& format) {
+	if (name == "p3") format = image_format::p3;
+	else if (name == "p6" || name == "ppm") format = image_format::p6;
+	else if (name == "pfm") format = image_format::pfm;
+	else if (name == "png") format = image_format::png;
+	else return false;
+	return true;
+}
+
+// Pick the format from a file extension, keeping fallback for unknown or missing extensions.
+inline image_format image_format_for_file(const std::string& path, image_format fallback) {
+	auto dot = path.rfind('.');
+	if (dot == std::string::npos) return fallback;
+	image_format format = fallback;
+	parse_image_format(path.substr(dot + 1), format);
+	return format;
+}
+
+// Minimal zlib/PNG building blocks. Rows are compressed with fixed-Huffman deflate blocks, each
+// ended by an empty stored block so that every row is byte aligned and can be compressed on its
+// own thread.
+namespace png_detail {
+	inline uint32_t crc32(const unsigned char* data, size_t n, uint32_t crc = 0) {
+		static const auto table = [] {
+			std::vector<uint32_t> t(256);
+			for (uint32_t i = 0; i < 256; ++i) {
+				uint32_t c = i;
+				for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				t[i] = c;
+			}
+			return t;
+		}();
+
+		crc = ~crc;
+		for (size_t i = 0; i < n; ++i) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	inline uint32_t adler32(const unsigned char* data, size_t n, uint32_t adler = 1) {
+		uint32_t a = adler & 0xffff, b = adler >> 16;
+		while (n > 0) {
+			size_t block = n < 5552 ? n : 5552;
+			n -= block;
+			while (block--) {
+				a += *data++;
+				b += a;
+			}
+			a %= 65521;
+			b %= 65521;
+		}
+		return (b << 16) | a;
+	}
+
+	// Adler-32 of the concatenation of two buffers from their checksums (as in zlib).
+	inline uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, uint64_t length2) {
+		const uint32_t base = 65521;
+		uint64_t rem = length2 % base;
+		uint64_t sum1 = adler1 & 0xffff;
+		uint64_t sum2 = (rem * sum1) % base;
+		sum1 += (adler2 & 0xffff) + base - 1;
+		sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + base - rem;
+		if (sum1 >= base) sum1 -= base;
+		if (sum1 >= base) sum1 -= base;
+		if (sum2 >= (uint64_t(base) << 1)) sum2 -= (uint64_t(base) << 1);
+		if (sum2 >= base) sum2 -= base;
+		return uint32_t(sum1 | (sum2 << 16));
+	}
+
+	inline void put_u32(std::string& out, uint32_t v) {
+		out.push_back(char(v >> 24));
+		out.push_back(char(v >> 16));
+		out.push_back(char(v >> 8));
+		out.push_back(char(v));
+	}
+
+	inline std::string chunk(const char* type, const std::string& data) {
+		std::string out;
+		put_u32(out, uint32_t(data.size()));
+		std::string body = std::string(type, 4) + data;
+		out += body;
+		put_u32(out, crc32(reinterpret_cast<const unsigned char*>(body.data()), body.size()));
+		return out;
+	}
+
+	class bit_writer {
+		public:
+			std::string bytes;
+
+			void put(uint32_t value, int count) {
+				buffer |= uint64_t(value) << bits;
+				bits += count;
+				while (bits >= 8) {
+					bytes.push_back(char(buffer & 0xff));
+					buffer >>= 8;
+					bits -= 8;
+				}
+			}
+
+			// Huffman codes are stored most significant bit first.
+			void put_code(uint32_t code, int length) {
+				uint32_t reversed = 0;
+				for (int i = 0; i < length; ++i) reversed |= ((code >> i) & 1) << (length - 1 - i);
+				put(reversed, length);
+			}
+
+			void align() {
+				if (bits > 0) put(0, 8 - bits);
+			}
+
+		private:
+			uint64_t buffer = 0;
+			int bits = 0;
+	};
+
+	// Literal/length symbol in the fixed Huffman code.
+	inline void put_symbol(bit_writer& w, int symbol) {
+		if (symbol <= 143) w.put_code(0x30 + symbol, 8);
+		else if (symbol <= 255) w.put_code(0x190 + symbol - 144, 9);
+		else if (symbol <= 279) w.put_code(symbol - 256, 7);
+		else w.put_code(0xc0 + symbol - 280, 8);
+	}
+
+	inline void put_match(bit_writer& w, int length, int distance) {
+		static const int length_base[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+		static const int length_extra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+		static const int distance_base[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+		static const int distance_extra[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+		int l = 28;
+		while (length_base[l] > length) l--;
+		put_symbol(w, 257 + l);
+		w.put(length - length_base[l], length_extra[l]);
+
+		int d = 29;
+		while (distance_base[d] > distance) d--;
+		w.put_code(d, 5);
+		w.put(distance - distance_base[d], distance_extra[d]);
+	}
+
+	// Compress data as one non-final fixed-Huffman block with greedy LZ77 matching, followed by
+	// an empty stored block to byte align the output.
+	inline std::string deflate_block(const unsigned char* data, size_t n) {
+		bit_writer w;
+		w.put(0, 1); // BFINAL
+		w.put(1, 2); // BTYPE = fixed Huffman
+
+		const int hash_size = 1 << 12;
+		std::vector<int> last(hash_size, -1);
+		auto hash = [&](size_t i) {
+			return ((data[i] << 8) ^ (data[i + 1] << 4) ^ data[i + 2]) & (hash_size - 1);
+		};
+
+		size_t i = 0;
+		while (i < n) {
+			int best_length = 0;
+			int best_distance = 0;
+			if (i + 2 < n) {
+				int h = hash(i);
+				int candidate = last[h];
+				last[h] = int(i);
+				if (candidate >= 0 && i - candidate <= 32768) {
+					size_t limit = std::min<size_t>(258, n - i);
+					size_t length = 0;
+					while (length < limit && data[candidate + length] == data[i + length]) length++;
+					if (length >= 3) {
+						best_length = int(length);
+						best_distance = int(i - candidate);
+					}
+				}
+			}
+
+			if (best_length > 0) {
+				put_match(w, best_length, best_distance);
+				i += best_length;
+			} else {
+				put_symbol(w, data[i]);
+				i++;
+			}
+		}
+
+		put_symbol(w, 256); // End of block
+		w.put(0, 3); // Empty stored block
+		w.align();
+		w.bytes += std::string("\x00\x00\xff\xff", 4);
+		return w.bytes;
+	}
+}
+
+// One encoded row. For PNG, checksum and raw_size describe the uncompressed row data.
+struct encoded_row {
+	std::string bytes;
+	uint32_t checksum = 1;
+	size_t raw_size = 0;
+};
+
+// Encodes rows of linear radiance in the chosen format.
+class image_encoder {
+	public:
+		image_encoder(image_format format, int width, int height) : format(format), width(width), height(height) {}
+
+		std::string header() const {
+			std::ostringstream out;
+			switch (format) {
+				case image_format::p3: out << "P3\n" << width << ' ' << height << "\n255\n"; break;
+				case image_format::p6: out << "P6\n" << width << ' ' << height << "\n255\n"; break;
+				case image_format::pfm: out << "PF\n" << width << ' ' << height << "\n-1.0\n"; break;
+				case image_format::png: {
+					std::string ihdr;
+					png_detail::put_u32(ihdr, uint32_t(width));
+					png_detail::put_u32(ihdr, uint32_t(height));
+					ihdr += std::string("\x08\x02\x00\x00\x00", 5); // 8-bit RGB, no interlace
+					out << "\x89PNG\r\n\x1a\n" << png_detail::chunk("IHDR", ihdr);
+					out << png_detail::chunk("IDAT", std::string("\x78\x01", 2)); // zlib header
+					break;
+				}
+			}
+			return out.str();
+		}
+
+		// Encode one row. Does not touch shared state, so rows can be encoded on any thread.
+		encoded_row encode_row(const color* row) const {
+			encoded_row result;
+			switch (format) {
+				case image_format::p3: {
+					std::ostringstream out;
+					for (int i = 0; i < width; ++i) write_color(out, row[i]);
+					result.bytes = out.str();
+					break;
+				}
+				case image_format::p6: {
+					result.bytes.resize(size_t(width) * 3);
+					for (int i = 0; i < width; ++i) {
+						result.bytes[3*i] = char(to_byte(row[i].x()));
+						result.bytes[3*i + 1] = char(to_byte(row[i].y()));
+						result.bytes[3*i + 2] = char(to_byte(row[i].z()));
+					}
+					break;
+				}
+				case image_format::pfm: {
+					result.bytes.resize(size_t(width) * 3 * sizeof(float));
+					std::vector<float> values(size_t(width) * 3);
+					for (int i = 0; i < width; ++i) {
+						values[3*i] = float(row[i].x());
+						values[3*i + 1] = float(row[i].y());
+						values[3*i + 2] = float(row[i].z());
+					}
+					// PFM with a negative scale is little endian, like the hosts we run on.
+					std::memcpy(&result.bytes[0], values.data(), result.bytes.size());
+					break;
+				}
+				case image_format::png: {
+					// Filter type 1 (Sub): each byte minus the same channel of the pixel to its left.
+					std::vector<unsigned char> raw(1 + size_t(width) * 3);
+					raw[0] = 1;
+					int previous[3] = {0, 0, 0};
+					for (int i = 0; i < width; ++i) {
+						int channels[3] = {to_byte(row[i].x()), to_byte(row[i].y()), to_byte(row[i].z())};
+						for (int c = 0; c < 3; ++c) {
+							raw[1 + 3*i + c] = (unsigned char)((channels[c] - previous[c]) & 0xff);
+							previous[c] = channels[c];
+						}
+					}
+					result.checksum = png_detail::adler32(raw.data(), raw.size());
+					result.raw_size = raw.size();
+					result.bytes = png_detail::chunk("IDAT", png_detail::deflate_block(raw.data(), raw.size()));
+					break;
+				}
+			}
+			return result;
+		}
+
+		// Trailer given the checksum of all rows written (only used by PNG).
+		std::string footer(uint32_t checksum) const {
+			if (format != image_format::png) return "";
+
+			png_detail::bit_writer w;
+			w.put(1, 1); // BFINAL
+			w.put(1, 2); // Fixed Huffman
+			png_detail::put_symbol(w, 256);
+			w.align();
+			png_detail::put_u32(w.bytes, checksum);
+			return png_detail::chunk("IDAT", w.bytes) + png_detail::chunk("IEND", "");
+		}
+
+		// PFM stores its rows from the bottom up, so it can't be written before the last row is in.
+		bool top_down() const { return format != image_format::pfm; }
+
+	private:
+		image_format format;
+		int width, height;
+};
+
+// Writes an image whose rows arrive in any order from any thread. Rows are encoded on the thread
+// that adds them and written out as soon as every row before them (in file order) is in.
+class image_stream {
+	public:
+		image_stream(std::ostream& out, image_format format, int width, int height)
+		  : out(out), encoder(format, width, height), width(width), height(height), rows(height), ready(height, 0)
+		{
+			write(encoder.header());
+		}
+
+		void add_row(int j, const color* row) {
+			encoded_row encoded = encoder.encode_row(row);
+
+			std::lock_guard<std::mutex> guard(lock);
+			rows[j] = std::move(encoded);
+			ready[j] = 1;
+			if (encoder.top_down()) {
+				while (next_row < height && ready[next_row]) write_row(next_row++);
+			}
+		}
+
+		// Write any rows still held back and the trailer. Every row must have been added.
+		void finish() {
+			std::lock_guard<std::mutex> guard(lock);
+			if (encoder.top_down()) {
+				while (next_row < height) write_row(next_row++);
+			} else {
+				for (int j = height - 1; j >= 0; --j) write_row(j);
+			}
+			write(encoder.footer(checksum));
+			out.flush();
+		}
+
+	private:
+		std::ostream& out;
+		image_encoder encoder;
+		int width, height;
+		std::mutex lock;
+		std::vector<encoded_row> rows;
+		std::vector<char> ready;
+		int next_row = 0;
+		uint32_t checksum = 1;
+
+		void write(const std::string& bytes) {
+			out.write(bytes.data(), std::streamsize(bytes.size()));
+		}
+
+		void write_row(int j) {
+			auto& row = rows[j];
+			write(row.bytes);
+			checksum = png_detail::adler32_combine(checksum, row.checksum, row.raw_size);
+			row = encoded_row();
+		}
+};
+
+// Write a whole image of linear radiance, encoding the rows in parallel.
+inline void write_image(std::ostream& out, image_format format, int width, int height, const std::vector<color>& pixels) {
+	image_stream stream(out, format, width, height);
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int j = 0; j < height; ++j) stream.add_row(j, &pixels[size_t(j) * width]);
+
+	stream.finish();
+}
+
+// Read a little-endian RGB PFM as written above, top row first. Returns false for anything else.
+inline bool read_pfm(std::istream& in, int& width, int& height, std::vector<color>& pixels) {
+	std::string magic;
+	double scale;
+	in >> magic >> width >> height >> scale;
+	in.get(); // The single whitespace character before the data
+	if (!in || magic != "PF" || width <= 0 || height <= 0 || scale >= 0) return false;
+
+	std::vector<float> values(size_t(width) * height * 3);
+	in.read(reinterpret_cast<char*>(values.data()), std::streamsize(values.size() * sizeof(float)));
+	if (!in) return false;
+
+	pixels.resize(size_t(width) * height);
+	for (int j = 0; j < height; ++j) {
+		const float* row = &values[size_t(height - 1 - j) * width * 3];
+		for (int i = 0; i < width; ++i) pixels[size_t(j) * width + i] = color(row[3*i], row[3*i + 1], row[3*i + 2]);
+	}
+	return true;
+}
+
+// YUV4MPEG2 video: one header, then one 8-bit 4:4:4 frame per call to add_frame. Uses BT.601
+// limited-range YCbCr, which is what players and ffmpeg assume for Y4M.
+class y4m_stream {
+	public:
+		y4m_stream(std::ostream& out, int width, int height, int fps) : out(out), width(width), height(height) {
+			out << "YUV4MPEG2 W" << width << " H" << height << " F" << fps << ":1 Ip A1:1 C444\n";
+		}
+
+		void add_frame(const std::vector<color>& pixels) {
+			size_t n = size_t(width) * height;
+			std::string planes(3 * n, '\0');
+
+			for (size_t p = 0; p < n; ++p) {
+				double r = to_byte(pixels[p].x());
+				double g = to_byte(pixels[p].y());
+				double b = to_byte(pixels[p].z());
+				planes[p] = char(clamp_byte(16 + (65.738 * r + 129.057 * g + 25.064 * b) / 256));
+				planes[n + p] = char(clamp_byte(128 + (-37.945 * r - 74.494 * g + 112.439 * b) / 256));
+				planes[2 * n + p] = char(clamp_byte(128 + (112.439 * r - 94.154 * g - 18.285 * b) / 256));
+			}
+
+			out << "FRAME\n";
+			out.write(planes.data(), std::streamsize(planes.size()));
+			out.flush();
+		}
+
+	private:
+		std::ostream& out;
+		int width, height;
+
+		static int clamp_byte(double x) {
+			int v = int(x + 0.5);
+			return v < 0 ? 0 : v > 255 ? 255 : v;
+		}
+};
@@ -3,6 +3,7 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_FAILURE_USERMSG
 #include "stb_image.h"
+#include "trace.h"
 
 #include <cstdlib>
 #include <iostream>
@@ -37,6 +38,7 @@ class read_image {
 
 	// Load the image given a file name.
     bool load(const std::string& filename) {
+        TRACE_SCOPE("read_image::load", filename);
 
         auto n = bytes_per_pixel;
         fdata = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
@@ -50,6 +52,12 @@ class read_image {
     int width()  const { return (fdata == nullptr) ? 0 : image_width; }
     int height() const { return (fdata == nullptr) ? 0 : image_height; }
 
+    // Heap bytes of the float and 8-bit copies of the pixels.
+    size_t data_bytes() const {
+        size_t values = size_t(image_width) * image_height * bytes_per_pixel;
+        return (fdata ? values * sizeof(float) : 0) + (bdata ? values : 0);
+    }
+
     const unsigned char* pixel_data(int x, int y) const {
         // Return the address of the three RGB bytes of the pixel at x,y. If there is no image
         // data, returns magenta.
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "intersectable.h"
+#include "transform.h"
+
+// One placement of a shared object, typically a mesh's BVH: a transform from the object's space
+// to the world, and optionally a material that replaces the object's own. Rays are taken into
+// the object's space instead of the object being copied, so any number of instances of a mesh
+// share one set of triangles and one tree. A bvh_node over instances is the top level of a
+// two-level hierarchy, with the meshes' trees as the bottom level.
+class instance : public intersectable {
+	public:
+		instance(shared_ptr<intersectable> object, const transform& to_world, shared_ptr<material> mat = nullptr)
+			: object(object), mat(mat) {
+			set_transform(to_world);
+			bbox = to_world.box(object->bounding_box());
+		}
+
+		// Bounds follow on the next refit().
+		void set_transform(const transform& t) {
+			to_world = t;
+			to_object = t.inverse();
+		}
+
+		// Only the instance's own bounds: the object is shared by other instances, so it would be
+		// refit once per instance. An object that changes itself is refit once by its owner.
+		void refit() override { bbox = to_world.box(object->bounding_box()); }
+
+		// The direction isn't normalized in object space, so hit distances are the same in both.
+		bool intersect(const ray& r, interval ray_t, intersects& inte) const override {
+			ray local(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+			if (!object->intersect(local, ray_t, inte)) return false;
+			place(inte);
+			return true;
+		}
+
+		// The lanes are moved into object space in place and put back after, rather than the whole
+		// packet copied for every instance it reaches.
+		void intersect_packet(ray_packet& packet, intersects* hits, uint32_t mask) const override {
+			ray world_rays[ray_packet::max_size];
+			bool hit_before[ray_packet::max_size];
+			for (uint32_t m = mask; m; m &= m - 1) {
+				int lane = __builtin_ctz(m);
+				const ray& r = packet.rays[lane];
+				world_rays[lane] = r;
+				hit_before[lane] = packet.hit[lane];
+				packet.set_ray(lane, ray(to_object.point(r.origin()), to_object.vector(r.direction()), r.time()));
+				packet.hit[lane] = false;
+			}
+
+			object->intersect_packet(packet, hits, mask);
+
+			for (uint32_t m = mask; m; m &= m - 1) {
+				int lane = __builtin_ctz(m);
+				packet.set_ray(lane, world_rays[lane]);
+				if (packet.hit[lane]) place(hits[lane]);
+				else packet.hit[lane] = hit_before[lane];
+			}
+		}
+
+		aabb bounding_box() const override { return bbox; }
+
+		// The object is shared, so it is counted with the first instance only.
+		void account_memory(memory_usage& usage) const override {
+			usage.add(memory_usage::instances, "instance", shared_bytes<instance>());
+			account_material(mat.get(), usage);
+			object->account(usage);
+		}
+
+	private:
+		shared_ptr<intersectable> object;
+		shared_ptr<material> mat; // Replaces the object's materials when set
+		transform to_world, to_object;
+		aabb bbox;
+
+		// Move a hit in object space to the world. Normals go by the inverse transpose, which keeps
+		// the side the ray came from, so front_face still holds.
+		void place(intersects& inte) const {
+			inte.p = to_world.point(inte.p);
+			inte.normal = unit_vector(to_object.transposed(inte.normal));
+			if (mat) inte.mat = mat;
+		}
+};
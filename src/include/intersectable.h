@@ -3,9 +3,13 @@
 #include "ray.h"
 #include "interval.h"
 #include "aabb.h"
+#include "memory_usage.h"
 
 class material;
 
+// Add a material and its textures to usage, once per material. Defined in material.h.
+inline void account_material(const material* mat, memory_usage& usage);
+
 class intersects {
 public:
 	point3d p;
@@ -29,6 +33,40 @@ public:
 	virtual bool intersect(const ray& r, interval ray_t, intersects& inte) const = 0;
 
 	virtual aabb bounding_box() const = 0;
+
+	// Recompute cached bounds bottom-up after objects below this one moved. Primitives don't cache
+	// anything, so there is nothing to do for them.
+	virtual void refit() {}
+
+	// Add the memory held by this object and everything below it to usage, once per object.
+	void account(memory_usage& usage) const {
+		if (usage.first_visit(this)) account_memory(usage);
+	}
+
+	virtual void account_memory(memory_usage& usage) const {}
+
+	// Intersect the lanes of the packet selected by mask. A lane that hits something closer than
+	// its t_max gets hit set, t_max lowered to the hit and hits[lane] filled in.
+	virtual void intersect_packet(ray_packet& packet, intersects* hits, uint32_t mask) const {
+		intersect_lanes(packet, hits, mask);
+	}
+
+	// Trace the selected lanes one at a time with intersect().
+	void intersect_lanes(ray_packet& packet, intersects* hits, uint32_t mask) const {
+		while (mask) {
+			int lane = __builtin_ctz(mask);
+			mask &= mask - 1;
+
+			packet.begin_lane(lane);
+			intersects temp_inte;
+			if (intersect(packet.rays[lane], interval(packet.t_min[lane], packet.t_max[lane]), temp_inte)) {
+				hits[lane] = temp_inte;
+				packet.t_max[lane] = temp_inte.t;
+				packet.hit[lane] = true;
+			}
+			packet.end_lane(lane);
+		}
+	}
 };
 
 class translate : public intersectable {
@@ -37,6 +75,14 @@ class translate : public intersectable {
 			bbox = object->bounding_box() + offset;
 		}
 
+		// Takes effect on the next refit().
+		void set_offset(const vec3d& new_offset) { offset = new_offset; }
+
+		void refit() override {
+			object->refit();
+			bbox = object->bounding_box() + offset;
+		}
+
 		bool intersect(const ray& r, interval ray_t, intersects& inte) const override {
 			ray offset_r(r.origin() - offset, r.direction(), r.time());
 
@@ -47,10 +93,38 @@ class translate : public intersectable {
 			return true;
 		}
 
+		// Lanes are offset in place and put back after, as instance does.
+		void intersect_packet(ray_packet& packet, intersects* hits, uint32_t mask) const override {
+			ray world_rays[ray_packet::max_size];
+			bool hit_before[ray_packet::max_size];
+			for (uint32_t m = mask; m; m &= m - 1) {
+				int lane = __builtin_ctz(m);
+				const ray& r = packet.rays[lane];
+				world_rays[lane] = r;
+				hit_before[lane] = packet.hit[lane];
+				packet.set_ray(lane, ray(r.origin() - offset, r.direction(), r.time()));
+				packet.hit[lane] = false;
+			}
+
+			object->intersect_packet(packet, hits, mask);
+
+			for (uint32_t m = mask; m; m &= m - 1) {
+				int lane = __builtin_ctz(m);
+				packet.set_ray(lane, world_rays[lane]);
+				if (packet.hit[lane]) hits[lane].p += offset;
+				else packet.hit[lane] = hit_before[lane];
+			}
+		}
+
 	aabb bounding_box() const override {
 		return bbox;
 	}
 
+	void account_memory(memory_usage& usage) const override {
+		usage.add(memory_usage::instances, "translate", shared_bytes<translate>());
+		object->account(usage);
+	}
+
 	private:
 		shared_ptr<intersectable> object;
 		vec3d offset;
@@ -61,35 +135,20 @@ class rotate_y : public intersectable {
 	public:
 
 		rotate_y(shared_ptr<intersectable> object, double angle) : object(object) {
+			set_angle(angle);
+			update_bbox();
+		}
+
+		// Takes effect on the next refit().
+		void set_angle(double angle) {
 			auto radians = degrees_to_radians(angle);
 			sin_theta = std::sin(radians);
 			cos_theta = std::cos(radians);
-			bbox = object->bounding_box();
-
-			point3d min( infinity,  infinity,  infinity);
-			point3d max(-infinity, -infinity, -infinity);
-
-			for (int i = 0; i < 2; i++) {
-				for (int j = 0; j < 2; j++) {
-					for (int k = 0; k < 2; k++) {
-						auto x = i*bbox.x.max + (1-i)*bbox.x.min;
-						auto y = j*bbox.y.max + (1-j)*bbox.y.min;
-						auto z = k*bbox.z.max + (1-k)*bbox.z.min;
-
-						auto newx =  cos_theta*x + sin_theta*z;
-						auto newz = -sin_theta*x + cos_theta*z;
-
-						vec3d tester(newx, y, newz);
-
-						for (int c = 0; c < 3; c++) {
-							min[c] = std::fmin(min[c], tester[c]);
-							max[c] = std::fmax(max[c], tester[c]);
-						}
-					}
-				}
-			}
+		}
 
-			bbox = aabb(min, max);
+		void refit() override {
+			object->refit();
+			update_bbox();
 		}
 
 		bool intersect(const ray& r, interval ray_t, intersects& inte) const override {
@@ -109,13 +168,79 @@ class rotate_y : public intersectable {
 			return true;
 		}
 
+		// Lanes are rotated in place and put back after, as instance does.
+		void intersect_packet(ray_packet& packet, intersects* hits, uint32_t mask) const override {
+			ray world_rays[ray_packet::max_size];
+			bool hit_before[ray_packet::max_size];
+			for (uint32_t m = mask; m; m &= m - 1) {
+				int lane = __builtin_ctz(m);
+				const ray& r = packet.rays[lane];
+				world_rays[lane] = r;
+				hit_before[lane] = packet.hit[lane];
+				auto origin = point3d((cos_theta * r.origin().x()) - (sin_theta * r.origin().z()), r.origin().y(), (sin_theta * r.origin().x()) + (cos_theta * r.origin().z()));
+				auto direction = vec3d((cos_theta * r.direction().x()) - (sin_theta * r.direction().z()), r.direction().y(), (sin_theta * r.direction().x()) + (cos_theta * r.direction().z()));
+				packet.set_ray(lane, ray(origin, direction, r.time()));
+				packet.hit[lane] = false;
+			}
+
+			object->intersect_packet(packet, hits, mask);
+
+			for (uint32_t m = mask; m; m &= m - 1) {
+				int lane = __builtin_ctz(m);
+				packet.set_ray(lane, world_rays[lane]);
+				if (!packet.hit[lane]) {
+					packet.hit[lane] = hit_before[lane];
+					continue;
+				}
+
+				auto& inte = hits[lane];
+				inte.p = point3d((cos_theta * inte.p.x()) + (sin_theta * inte.p.z()), inte.p.y(), (-sin_theta * inte.p.x()) + (cos_theta * inte.p.z()));
+				inte.normal = vec3d((cos_theta * inte.normal.x()) + (sin_theta * inte.normal.z()), inte.normal.y(),(-sin_theta * inte.normal.x()) + (cos_theta * inte.normal.z()));
+			}
+		}
+
 		aabb bounding_box() const override {
 			return bbox;
 		}
 
+		void account_memory(memory_usage& usage) const override {
+			usage.add(memory_usage::instances, "rotate_y", shared_bytes<rotate_y>());
+			object->account(usage);
+		}
+
 	private:
 		shared_ptr<intersectable> object;
 		double sin_theta;
 		double cos_theta;
 		aabb bbox;
+
+		// Box around the rotated corners of the object's box.
+		void update_bbox() {
+			bbox = object->bounding_box();
+
+			point3d min( infinity,  infinity,  infinity);
+			point3d max(-infinity, -infinity, -infinity);
+
+			for (int i = 0; i < 2; i++) {
+				for (int j = 0; j < 2; j++) {
+					for (int k = 0; k < 2; k++) {
+						auto x = i*bbox.x.max + (1-i)*bbox.x.min;
+						auto y = j*bbox.y.max + (1-j)*bbox.y.min;
+						auto z = k*bbox.z.max + (1-k)*bbox.z.min;
+
+						auto newx =  cos_theta*x + sin_theta*z;
+						auto newz = -sin_theta*x + cos_theta*z;
+
+						vec3d tester(newx, y, newz);
+
+						for (int c = 0; c < 3; c++) {
+							min[c] = std::fmin(min[c], tester[c]);
+							max[c] = std::fmax(max[c], tester[c]);
+						}
+					}
+				}
+			}
+
+			bbox = aabb(min, max);
+		}
 };
@@ -39,7 +39,25 @@ class intersectable_list : public intersectable {
 			return object_intersected;
 		}
 
+		void intersect_packet(ray_packet& packet, intersects* hits, uint32_t mask) const override {
+			for (const auto& object : objects) object->intersect_packet(packet, hits, mask);
+		}
+
 		aabb bounding_box() const override { return bbox; }
+
+		void refit() override {
+			bbox = aabb();
+			for (const auto& object : objects) {
+				object->refit();
+				bbox = aabb(bbox, object->bounding_box());
+			}
+		}
+
+		void account_memory(memory_usage& usage) const override {
+			usage.add(memory_usage::bvh, "intersectable_list", shared_bytes<intersectable_list>() + objects.capacity() * sizeof(objects[0]));
+			for (const auto& object : objects) object->account(usage);
+		}
+
 	private:
 		aabb bbox;
 };
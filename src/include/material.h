@@ -1,12 +1,29 @@
 #pragma once
 
 #include "intersectable.h"
+#include "sampler.h"
 #include "texture.h"
 
+// Material families, used to group hits that share shading code.
+enum class material_kind { lambertian, metal, dielectric, diffuse_light, isotropic, other };
+
+inline const char* material_kind_name(material_kind kind) {
+	switch (kind) {
+		case material_kind::lambertian: return "lambertian";
+		case material_kind::metal: return "metal";
+		case material_kind::dielectric: return "dielectric";
+		case material_kind::diffuse_light: return "diffuse_light";
+		case material_kind::isotropic: return "isotropic";
+		default: return "other";
+	}
+}
+
 class material {
 	public:
 		virtual ~material() = default;
 
+		virtual material_kind kind() const { return material_kind::other; }
+
 		virtual bool scatter(const ray& r_in, const intersects& inte, color& attenuation, ray& scattered) const {
 			return false;
 		}
@@ -14,15 +31,25 @@ class material {
 		virtual color emitted(double u, double v, const point3d& p) const {
 			return color(0, 0, 0);
 		}
+
+		// Add the memory held by this material and its textures to usage, once per material.
+		void account(memory_usage& usage) const {
+			if (usage.first_visit(this)) account_memory(usage);
+		}
+
+		virtual void account_memory(memory_usage& usage) const {}
 };
 
 class lambertian : public material {
 	public:
+		material_kind kind() const override { return material_kind::lambertian; }
+
 		lambertian(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
 		lambertian(shared_ptr<texture> tex) : tex(tex) {}
 
 		bool scatter(const ray& r_in, const intersects& inte, color& attenuation, ray& scattered) const override {
-			auto scatter_direction = inte.normal + random_unit_vector();
+			auto s = sample_2d();
+			auto scatter_direction = inte.normal + sample_unit_vector(s.u, s.v);
 
 			if (scatter_direction.near_zero()) scatter_direction = inte.normal;
 
@@ -31,6 +58,11 @@ class lambertian : public material {
 			return true;
 		}
 
+		void account_memory(memory_usage& usage) const override {
+			usage.add(memory_usage::materials, "lambertian", shared_bytes<lambertian>());
+			tex->account(usage);
+		}
+
 	private:
 		shared_ptr<texture> tex;
 		color albedo;
@@ -38,16 +70,23 @@ class lambertian : public material {
 
 class metal : public material {
 	public:
+		material_kind kind() const override { return material_kind::metal; }
+
 		metal(const color& albedo, double fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
 
 		bool scatter(const ray& r_in, const intersects& inte, color& attenuation, ray& scattered) const override {
 			vec3d reflected = reflect(r_in.direction(), inte.normal);
-			reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
+			auto s = sample_2d();
+			reflected = unit_vector(reflected) + (fuzz * sample_unit_vector(s.u, s.v));
 			scattered = ray(inte.p, reflected, r_in.time());
 			attenuation = albedo;
 			return (dot(scattered.direction(), inte.normal) > 0);
 		}
 
+		void account_memory(memory_usage& usage) const override {
+			usage.add(memory_usage::materials, "metal", shared_bytes<metal>());
+		}
+
 	private:
 		color albedo;
 		double fuzz;
@@ -55,6 +94,8 @@ class metal : public material {
 
 class dielectric : public material {
 	public:
+		material_kind kind() const override { return material_kind::dielectric; }
+
 		dielectric(double refraction_index) : refraction_index(refraction_index) {}
 
 		bool scatter(const ray& r_in, const intersects& inte, color& attenuation, ray& scattered) const override {
@@ -69,13 +110,17 @@ class dielectric : public material {
 
 			vec3d direction;
 
-			if (must_reflect || reflectance(cos_theta, ri) > random_double()) direction = reflect(unit_direction, inte.normal);
+			if (must_reflect || reflectance(cos_theta, ri) > sample_1d()) direction = reflect(unit_direction, inte.normal);
 			else direction = refract(unit_direction, inte.normal, ri);
 
 			scattered = ray(inte.p, direction, r_in.time());
 			return true;
 		}
 
+		void account_memory(memory_usage& usage) const override {
+			usage.add(memory_usage::materials, "dielectric", shared_bytes<dielectric>());
+		}
+
 	private:
 		// Refractive index
 		double refraction_index;
@@ -90,6 +135,8 @@ class dielectric : public material {
 
 class diffuse_light : public material {
 	public:
+		material_kind kind() const override { return material_kind::diffuse_light; }
+
 		diffuse_light(shared_ptr<texture> tex) : tex(tex) {}
 		diffuse_light(const color& emit) : tex(make_shared<solid_color>(emit)) {}
 
@@ -97,21 +144,38 @@ class diffuse_light : public material {
 			return tex->value(u, v, p);
 		}
 
+		void account_memory(memory_usage& usage) const override {
+			usage.add(memory_usage::materials, "diffuse_light", shared_bytes<diffuse_light>());
+			tex->account(usage);
+		}
+
 	private:
 		shared_ptr<texture> tex;
 };
 
 class isotropic : public material {
 	public:
+		material_kind kind() const override { return material_kind::isotropic; }
+
 		isotropic(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
 		isotropic(shared_ptr<texture> tex) : tex(tex) {}
 
 		bool scatter(const ray& r_in, const intersects& inte, color& attenuation, ray& scattered) const override {
-			scattered = ray(inte.p, random_unit_vector(), r_in.time());
+			auto s = sample_2d();
+			scattered = ray(inte.p, sample_unit_vector(s.u, s.v), r_in.time());
 			attenuation = tex->value(inte.u, inte.v, inte.p);
 			return true;
 		}
 
+		void account_memory(memory_usage& usage) const override {
+			usage.add(memory_usage::materials, "isotropic", shared_bytes<isotropic>());
+			tex->account(usage);
+		}
+
 	private:
 		shared_ptr<texture> tex;
 };
+
+inline void account_material(const material* mat, memory_usage& usage) {
+	if (mat) mat->account(usage);
+}
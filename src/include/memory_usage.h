@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Bytes held by a scene, by category and by type, gathered by walking the scene graph with
+// intersectable::account(). Objects with several owners (materials, textures, instanced subtrees)
+// are counted on their first visit only.
+class memory_usage {
+	public:
+		enum category { primitives, bvh, instances, materials, textures, framebuffer, category_count };
+
+		struct type_total {
+			long long count = 0;
+			size_t bytes = 0;
+		};
+
+		size_t bytes[category_count] = {};
+		std::map<std::string, type_total> types;
+
+		// True the first time an object is seen, after which it has been accounted for.
+		bool first_visit(const void* object) { return visited.insert(object).second; }
+
+		void add(category c, const std::string& type, size_t object_bytes) {
+			bytes[c] += object_bytes;
+			types[type].count++;
+			types[type].bytes += object_bytes;
+		}
+
+		size_t total() const {
+			size_t sum = 0;
+			for (auto b : bytes) sum += b;
+			return sum;
+		}
+
+		// Table of the bytes by category, then the count, bytes and average size of each type.
+		void print(std::ostream& out) const {
+			out << std::fixed << std::setprecision(2);
+			out << "Scene memory:\n";
+			for (int c = 0; c < category_count; ++c) {
+				out << "  " << std::left << std::setw(20) << category_name(c) << std::right << std::setw(12) << bytes[c] / 1048576.0 << " MB\n";
+			}
+			out << "  " << std::left << std::setw(20) << "total" << std::right << std::setw(12) << total() / 1048576.0 << " MB\n";
+			for (const auto& [type, t] : types) {
+				out << "  " << std::left << std::setw(20) << type << std::right << std::setw(12) << t.bytes / 1048576.0 << " MB  "
+					<< std::setw(10) << t.count << " x " << std::setprecision(0) << double(t.bytes) / t.count << " B\n" << std::setprecision(2);
+			}
+			out << std::defaultfloat;
+		}
+
+		static const char* category_name(int c) {
+			static const char* names[category_count] = {"primitives", "bvh", "instances", "materials", "textures", "framebuffer"};
+			return names[c];
+		}
+
+	private:
+		std::unordered_set<const void*> visited;
+};
+
+// Bytes of an object allocated with make_shared: the object itself and the reference counts and
+// vtable pointer libstdc++ keeps in the same allocation.
+template <typename T>
+constexpr size_t shared_bytes() { return sizeof(T) + 16; }
+
+// Resident set size of the process now and at its peak, from /proc/self/status. Zero where that
+// isn't available.
+struct process_memory {
+	size_t rss = 0;
+	size_t peak_rss = 0;
+
+	static process_memory now() {
+		process_memory m;
+		std::ifstream status("/proc/self/status");
+		std::string key;
+		size_t kilobytes;
+		while (status >> key) {
+			if (key == "VmRSS:" && status >> kilobytes) m.rss = kilobytes * 1024;
+			else if (key == "VmHWM:" && status >> kilobytes) m.peak_rss = kilobytes * 1024;
+		}
+		return m;
+	}
+};
+
+// Process memory recorded at the end of each phase of a run.
+struct memory_phases {
+	std::vector<std::pair<std::string, process_memory>> phases;
+
+	void mark(const std::string& name) { phases.push_back({name, process_memory::now()}); }
+
+	void print(std::ostream& out) const {
+		out << std::fixed << std::setprecision(1) << "Process memory (RSS / peak RSS):\n";
+		for (const auto& [name, m] : phases) {
+			out << "  " << std::left << std::setw(20) << name << std::right << std::setw(10) << m.rss / 1048576.0 << " MB"
+				<< std::setw(10) << m.peak_rss / 1048576.0 << " MB\n";
+		}
+		out << std::defaultfloat;
+	}
+};
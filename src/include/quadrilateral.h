@@ -21,7 +21,13 @@ class quadrilateral : public intersectable {
 
 		aabb bounding_box() const override { return bbox; }
 
+		void account_memory(memory_usage& usage) const override {
+			usage.add(memory_usage::primitives, "quadrilateral", shared_bytes<quadrilateral>());
+			account_material(mat.get(), usage);
+		}
+
 		bool intersect(const ray& r, interval ray_t, intersects& inte) const override {
+			thread_counters.quad_tests++;
 			auto denominator = dot(normal, r.direction());
 
 			if (std::fabs(denominator) < 1e-8) return false;
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "aabb.h"
+#include "ray.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// A ray the renderer gave to world.intersect, and what it hit. Kept in full precision so a
+// replay traces exactly the same ray.
+struct captured_ray {
+	double origin[3];
+	double direction[3];
+	double time;
+	double t_min, t_max;
+	double hit_t; // Distance to the closest hit, infinity for a miss
+	uint32_t pixel;
+	uint32_t sample;
+	uint32_t bounce; // 0 for camera rays
+	uint32_t hit;
+
+	ray get_ray() const {
+		return ray(point3d(origin[0], origin[1], origin[2]), vec3d(direction[0], direction[1], direction[2]), time);
+	}
+};
+
+// Collects the rays of the samples being captured on this thread. The camera points buffer at
+// the worker's list for the duration of a tile, and begin_sample() arms recording for the
+// samples of captured pixels only, so other samples pay one pointer test.
+struct ray_recorder {
+	std::vector<captured_ray>* buffer = nullptr; // Null when the render captures nothing
+	std::vector<captured_ray>* active = nullptr; // Set while a captured sample is traced
+	int stride = 1;
+	uint32_t pixel = 0;
+	uint32_t sample = 0;
+
+	// Rays of every stride-th pixel are kept.
+	bool captures(int p) const { return buffer && p % stride == 0; }
+
+	void begin_sample(int p, int s) {
+		active = captures(p) ? buffer : nullptr;
+		pixel = uint32_t(p);
+		sample = uint32_t(s);
+	}
+
+	// hit_t is the distance to the hit, infinity for a miss.
+	void record(uint32_t p, uint32_t s, int bounce, const ray& r, const interval& ray_t, bool hit, double hit_t) {
+		captured_ray c;
+		for (int axis = 0; axis < 3; ++axis) {
+			c.origin[axis] = r.origin()[axis];
+			c.direction[axis] = r.direction()[axis];
+		}
+		c.time = r.time();
+		c.t_min = ray_t.min;
+		c.t_max = ray_t.max;
+		c.hit_t = hit_t;
+		c.pixel = p;
+		c.sample = s;
+		c.bounce = uint32_t(bounce);
+		c.hit = hit;
+		buffer->push_back(c);
+	}
+
+	void record(int bounce, const ray& r, const interval& ray_t, bool hit, double hit_t) {
+		record(pixel, sample, bounce, r, ray_t, hit, hit_t);
+	}
+};
+
+inline thread_local ray_recorder thread_recorder;
+
+// Layout of a capture file: magic, ray count, the world's bounding box (six doubles) so replays
+// can check they were given the same scene, then the rays.
+constexpr char ray_capture_magic[8] = {'R', 'T', 'R', 'A', 'Y', 'S', '0', '1'};
+
+inline bool save_ray_capture(const std::string& path, const aabb& bounds, std::vector<captured_ray> rays) {
+	// Ordered by (pixel, sample, bounce) so the file doesn't depend on the thread count.
+	std::sort(rays.begin(), rays.end(), [](const captured_ray& a, const captured_ray& b) {
+		if (a.pixel != b.pixel) return a.pixel < b.pixel;
+		if (a.sample != b.sample) return a.sample < b.sample;
+		return a.bounce < b.bounce;
+	});
+
+	std::ofstream out(path, std::ios::binary);
+	if (!out) return false;
+	uint64_t count = rays.size();
+	double box[6] = {bounds.x.min, bounds.x.max, bounds.y.min, bounds.y.max, bounds.z.min, bounds.z.max};
+	out.write(ray_capture_magic, sizeof(ray_capture_magic));
+	out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+	out.write(reinterpret_cast<const char*>(box), sizeof(box));
+	out.write(reinterpret_cast<const char*>(rays.data()), std::streamsize(rays.size() * sizeof(captured_ray)));
+	return bool(out);
+}
+
+inline bool load_ray_capture(const std::string& path, aabb& bounds, std::vector<captured_ray>& rays) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in) return false;
+
+	char magic[sizeof(ray_capture_magic)];
+	in.read(magic, sizeof(magic));
+	if (!in || !std::equal(magic, magic + sizeof(magic), ray_capture_magic)) return false;
+
+	uint64_t count = 0;
+	double box[6];
+	in.read(reinterpret_cast<char*>(&count), sizeof(count));
+	in.read(reinterpret_cast<char*>(box), sizeof(box));
+	if (!in) return false;
+	bounds = aabb(interval(box[0], box[1]), interval(box[2], box[3]), interval(box[4], box[5]));
+
+	rays.resize(count);
+	in.read(reinterpret_cast<char*>(rays.data()), std::streamsize(count * sizeof(captured_ray)));
+	return bool(in);
+}
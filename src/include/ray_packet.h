@@ -0,0 +1,55 @@
+#pragma once
+
+#include "ray.h"
+#include "sampler.h"
+
+#include <cstdint>
+
+// A group of up to max_size rays traced through the scene together. The rays are kept both as
+// ray objects (for scalar fallbacks) and as arrays per component so that box tests can run over
+// all lanes at once. Lanes are addressed with bit masks.
+struct ray_packet {
+	static constexpr int max_size = 16;
+
+	int size = 0;
+	ray rays[max_size];
+	double origin_x[max_size], origin_y[max_size], origin_z[max_size];
+	double inv_direction_x[max_size], inv_direction_y[max_size], inv_direction_z[max_size];
+	double t_min[max_size], t_max[max_size]; // t_max shrinks to the closest hit found so far
+	bool hit[max_size];
+
+	// Sampler position of every lane, restored before a lane is traced on its own so that objects
+	// which draw samples during intersection (participating media) see the lane's own sequence.
+	sampler* smp = nullptr;
+	uint64_t pixel[max_size];
+	int sample[max_size];
+	int dimension[max_size];
+
+	void set_ray(int lane, const ray& r) {
+		rays[lane] = r;
+		origin_x[lane] = r.origin().x();
+		origin_y[lane] = r.origin().y();
+		origin_z[lane] = r.origin().z();
+		inv_direction_x[lane] = 1.0 / r.direction().x();
+		inv_direction_y[lane] = 1.0 / r.direction().y();
+		inv_direction_z[lane] = 1.0 / r.direction().z();
+	}
+
+	uint32_t all_lanes() const {
+		return size >= 32 ? ~0u : (1u << size) - 1;
+	}
+
+	// Few enough lanes are left that tracing them one by one beats testing the whole packet.
+	bool diverged(uint32_t mask) const {
+		int active = __builtin_popcount(mask);
+		return active < 2 || active * 4 <= size;
+	}
+
+	void begin_lane(int lane) {
+		if (smp) smp->start_pixel_sample(pixel[lane], sample[lane], dimension[lane]);
+	}
+
+	void end_lane(int lane) {
+		if (smp) dimension[lane] = smp->current_dimension();
+	}
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+// Event counts of a render. Every thread counts into its own thread_counters, so the
+// intersection routines pay a plain increment and no atomics; the camera collects each thread's
+// counts after every tile and sums them at the end.
+struct render_counters {
+	static constexpr int material_kinds = 6; // Entries of material_kind
+	static constexpr int path_length_bins = 65; // Paths of 64 segments or more share the last bin
+
+	long long camera_rays = 0;
+	long long secondary_rays = 0;
+	long long bvh_nodes = 0; // bvh_node visits, once per ray or once per packet
+	long long box_tests = 0; // Ray-box slab tests, per ray
+	long long triangle_tests = 0;
+	long long sphere_tests = 0;
+	long long quad_tests = 0;
+	long long material_hits[material_kinds] = {};
+	long long path_lengths[path_length_bins] = {}; // Paths by number of segments traced
+
+	long long rays() const { return camera_rays + secondary_rays; }
+
+	long long paths() const { return camera_rays; }
+
+	// A finished path of the given number of segments: one camera ray, the rest secondary.
+	void add_path(int segments) {
+		camera_rays++;
+		secondary_rays += segments - 1;
+		path_lengths[std::min(segments, path_length_bins - 1)]++;
+	}
+
+	void merge(const render_counters& other) {
+		camera_rays += other.camera_rays;
+		secondary_rays += other.secondary_rays;
+		bvh_nodes += other.bvh_nodes;
+		box_tests += other.box_tests;
+		triangle_tests += other.triangle_tests;
+		sphere_tests += other.sphere_tests;
+		quad_tests += other.quad_tests;
+		for (int k = 0; k < material_kinds; ++k) material_hits[k] += other.material_hits[k];
+		for (int k = 0; k < path_length_bins; ++k) path_lengths[k] += other.path_lengths[k];
+	}
+};
+
+inline thread_local render_counters thread_counters;
+
+// What the per-pixel cost heatmap measures.
+enum class cost_metric {
+	bvh_nodes, // BVH nodes visited; a packet's visits are shared by its pixels
+	primitive_tests, // Ray-triangle, ray-sphere and ray-quadrilateral tests
+	time // Nanoseconds spent tracing and shading
+};
+
+inline bool parse_cost_metric(const std::string& name, cost_metric& metric) {
+	if (name == "nodes") metric = cost_metric::bvh_nodes;
+	else if (name == "tests") metric = cost_metric::primitive_tests;
+	else if (name == "time") metric = cost_metric::time;
+	else return false;
+	return true;
+}
+
+inline const char* cost_metric_name(cost_metric metric) {
+	switch (metric) {
+		case cost_metric::bvh_nodes: return "BVH nodes";
+		case cost_metric::primitive_tests: return "primitive tests";
+		default: return "nanoseconds";
+	}
+}
+
+// Running total of the metric on this thread. The cost of some work is the difference between
+// the totals before and after it.
+inline double current_cost(cost_metric metric) {
+	switch (metric) {
+		case cost_metric::bvh_nodes: return double(thread_counters.bvh_nodes);
+		case cost_metric::primitive_tests: return double(thread_counters.triangle_tests + thread_counters.sphere_tests + thread_counters.quad_tests);
+		default: return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
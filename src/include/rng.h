@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+
+// 64-bit finalizer (splitmix64) used to turn structured seeds into well mixed state.
+inline uint64_t mix_bits(uint64_t v) {
+	v ^= v >> 31;
+	v *= 0x7fb5d329728ea185ULL;
+	v ^= v >> 27;
+	v *= 0x81dadef4bc2dd44dULL;
+	v ^= v >> 33;
+	return v;
+}
+
+// Hash a (pixel, sample, frame) triple into a 64-bit seed.
+inline uint64_t hash_seed(uint64_t a, uint64_t b, uint64_t c) {
+	return mix_bits(mix_bits(mix_bits(a) ^ b) ^ c);
+}
+
+// PCG32 (XSH-RR) generator: 16 bytes of state, 32 random bits per step.
+class pcg32 {
+	public:
+		pcg32() : state(0x853c49e6748fea9bULL), inc(0xda3e39cb94b95bdbULL) {}
+		pcg32(uint64_t seed_state, uint64_t sequence = 1) { seed(seed_state, sequence); }
+
+		void seed(uint64_t seed_state, uint64_t sequence = 1) {
+			state = 0;
+			inc = (sequence << 1) | 1;
+			next_uint();
+			state += seed_state;
+			next_uint();
+		}
+
+		uint32_t next_uint() {
+			uint64_t old = state;
+			state = old * multiplier + inc;
+			uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+			uint32_t rot = uint32_t(old >> 59);
+			return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+		}
+
+		// Uniform double in [0, 1) with 32 bits of randomness.
+		double next_double() {
+			return next_uint() * 0x1p-32;
+		}
+
+		// Jump the sequence by delta steps in O(log delta).
+		void advance(uint64_t delta) {
+			uint64_t cur_mult = multiplier, cur_plus = inc, acc_mult = 1, acc_plus = 0;
+			while (delta > 0) {
+				if (delta & 1) {
+					acc_mult *= cur_mult;
+					acc_plus = acc_plus * cur_mult + cur_plus;
+				}
+				cur_plus = (cur_mult + 1) * cur_plus;
+				cur_mult *= cur_mult;
+				delta >>= 1;
+			}
+			state = acc_mult * state + acc_plus;
+		}
+
+	private:
+		static constexpr uint64_t multiplier = 0x5851f42d4c957f2dULL;
+		uint64_t state, inc;
+};
+
+// Four PCG32 streams stepped in lockstep. The lanes are independent, so the update and the
+// conversion to double are straight-line loops the compiler can keep in SIMD registers.
+class pcg32x4 {
+	public:
+		static constexpr int lanes = 4;
+
+		pcg32x4() { seed(0); }
+
+		void seed(uint64_t seed_state) {
+			for (int i = 0; i < lanes; ++i) {
+				state[i] = mix_bits(seed_state ^ (0x9e3779b97f4a7c15ULL * (i + 1)));
+				inc[i] = (uint64_t(i) << 1) | 1;
+			}
+		}
+
+		// Fill all four lanes with uniform doubles in [0, 1).
+		void next_doubles(double out[lanes]) {
+			uint32_t bits[lanes];
+			for (int i = 0; i < lanes; ++i) {
+				uint64_t old = state[i];
+				state[i] = old * 0x5851f42d4c957f2dULL + inc[i];
+				uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+				uint32_t rot = uint32_t(old >> 59);
+				bits[i] = (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+			}
+			for (int i = 0; i < lanes; ++i) out[i] = bits[i] * 0x1p-32;
+		}
+
+	private:
+		uint64_t state[lanes];
+		uint64_t inc[lanes];
+};
+
+// Per-thread generators. Every thread starts from the same default seed; the renderer reseeds
+// them from (pixel, sample, frame) before each camera sample so results don't depend on which
+// thread rendered a pixel.
+inline pcg32& thread_rng() {
+	thread_local pcg32 generator;
+	return generator;
+}
+
+inline pcg32x4& thread_rng4() {
+	thread_local pcg32x4 generator;
+	return generator;
+}
+
+inline void seed_thread_rng(uint64_t pixel_index, uint64_t sample_index, uint64_t frame) {
+	uint64_t seed = hash_seed(pixel_index, sample_index, frame);
+	thread_rng().seed(seed, frame);
+	thread_rng4().seed(seed);
+}
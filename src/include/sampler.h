@@ -0,0 +1,240 @@
+#pragma once
+
+#include "constants.h"
+#include "rng.h"
+
+#include <cstdint>
+
+// A pair of sample values in [0, 1).
+struct sample2d {
+	double u, v;
+};
+
+// Source of sample values for one camera sample of one pixel. Every value belongs to a
+// dimension; the renderer gives each sampling decision its own dimension so that low
+// discrepancy samplers stratify each decision separately across the samples of a pixel.
+// Samples are random access: any (pixel, sample, dimension) can be regenerated on its own.
+class sampler {
+	public:
+		virtual ~sampler() = default;
+
+		void start_pixel_sample(uint64_t pixel, int sample, int first_dimension = 0) {
+			pixel_index = pixel;
+			sample_index = sample;
+			dimension = first_dimension;
+		}
+
+		void set_dimension(int d) { dimension = d; }
+		int current_dimension() const { return dimension; }
+
+		double get_1d() {
+			return sample_1d(dimension++);
+		}
+
+		sample2d get_2d() {
+			auto s = sample_2d(dimension);
+			dimension += 2;
+			return s;
+		}
+
+	protected:
+		uint64_t pixel_index = 0;
+		int sample_index = 0;
+		int dimension = 0;
+
+		virtual double sample_1d(int d) const = 0;
+		virtual sample2d sample_2d(int d) const = 0;
+
+		// Seed that is distinct for every (pixel, dimension) pair.
+		uint64_t dimension_seed(int d) const {
+			return hash_seed(pixel_index, uint64_t(d), seed);
+		}
+
+	private:
+		static constexpr uint64_t seed = 0x5eed;
+};
+
+// Uncorrelated uniform values from a PCG32 stream positioned at (sample, dimension).
+class independent_sampler : public sampler {
+	protected:
+		double sample_1d(int d) const override {
+			return stream(d).next_double();
+		}
+
+		sample2d sample_2d(int d) const override {
+			auto rng = stream(d);
+			double u = rng.next_double();
+			return {u, rng.next_double()};
+		}
+
+	private:
+		pcg32 stream(int d) const {
+			pcg32 rng(hash_seed(pixel_index, 0, 0), 1);
+			rng.advance(uint64_t(sample_index) * 65536 + uint64_t(d));
+			return rng;
+		}
+};
+
+// Jittered strata, with the stratum for each sample index permuted per dimension so that
+// different dimensions are not correlated with each other.
+class stratified_sampler : public sampler {
+	public:
+		stratified_sampler(int samples_per_pixel) {
+			strata_1d = samples_per_pixel < 1 ? 1 : samples_per_pixel;
+			strata_2d = int(std::sqrt(double(strata_1d)));
+			if (strata_2d < 1) strata_2d = 1;
+		}
+
+	protected:
+		double sample_1d(int d) const override {
+			uint64_t h = dimension_seed(d);
+			int stratum = permutation_element(uint32_t(sample_index % strata_1d), uint32_t(strata_1d), uint32_t(h));
+			return (stratum + jitter(h, 0)) / strata_1d;
+		}
+
+		sample2d sample_2d(int d) const override {
+			// Samples beyond strata_2d^2 start another round of strata.
+			uint64_t h = dimension_seed(d);
+			int n = strata_2d * strata_2d;
+			int round = sample_index / n;
+			int stratum = permutation_element(uint32_t(sample_index % n), uint32_t(n), uint32_t(h ^ mix_bits(round)));
+			int x = stratum % strata_2d;
+			int y = stratum / strata_2d;
+			return {(x + jitter(h, 1)) / strata_2d, (y + jitter(h, 2)) / strata_2d};
+		}
+
+	private:
+		int strata_1d;
+		int strata_2d;
+
+		double jitter(uint64_t h, uint64_t lane) const {
+			return (mix_bits(h ^ (uint64_t(sample_index) << 8) ^ lane) >> 11) * 0x1p-53;
+		}
+
+		// Random permutation of [0, n) evaluated one element at a time (Kensler, "Correlated
+		// Multi-Jittered Sampling").
+		static int permutation_element(uint32_t i, uint32_t n, uint32_t p) {
+			uint32_t w = n - 1;
+			w |= w >> 1;
+			w |= w >> 2;
+			w |= w >> 4;
+			w |= w >> 8;
+			w |= w >> 16;
+			do {
+				i ^= p;
+				i *= 0xe170893d;
+				i ^= p >> 16;
+				i ^= (i & w) >> 4;
+				i ^= p >> 8;
+				i *= 0x0929eb3f;
+				i ^= p >> 23;
+				i ^= (i & w) >> 1;
+				i *= 1 | p >> 27;
+				i *= 0x6935fa69;
+				i ^= (i & w) >> 11;
+				i *= 0x74dcb303;
+				i ^= (i & w) >> 2;
+				i *= 0x9e501cc3;
+				i ^= (i & w) >> 2;
+				i *= 0xc860a3df;
+				i &= w;
+				i ^= i >> 5;
+			} while (i >= n);
+			return int((i + p) % n);
+		}
+};
+
+// First two dimensions of the Sobol sequence, padded across dimensions: each dimension
+// (or pair) shuffles the sample order and Owen-scrambles the values with its own seed
+// (Burley, "Practical Hash-based Owen Scrambling"). Converges fastest at power-of-two counts.
+class sobol_sampler : public sampler {
+	protected:
+		double sample_1d(int d) const override {
+			uint64_t h = dimension_seed(d);
+			uint32_t index = nested_uniform_scramble(uint32_t(sample_index), uint32_t(h));
+			return to_unit(nested_uniform_scramble(sobol_dimension0(index), uint32_t(h >> 32)));
+		}
+
+		sample2d sample_2d(int d) const override {
+			uint64_t h = dimension_seed(d);
+			uint32_t index = nested_uniform_scramble(uint32_t(sample_index), uint32_t(h));
+			uint64_t h2 = mix_bits(h);
+			return {
+				to_unit(nested_uniform_scramble(sobol_dimension0(index), uint32_t(h >> 32))),
+				to_unit(nested_uniform_scramble(sobol_dimension1(index), uint32_t(h2)))
+			};
+		}
+
+	private:
+		static double to_unit(uint32_t x) {
+			return x * 0x1p-32;
+		}
+
+		static uint32_t reverse_bits(uint32_t x) {
+			x = (x << 16) | (x >> 16);
+			x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+			x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+			x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+			x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+			return x;
+		}
+
+		// Van der Corput radical inverse in base 2.
+		static uint32_t sobol_dimension0(uint32_t index) {
+			return reverse_bits(index);
+		}
+
+		static uint32_t sobol_dimension1(uint32_t index) {
+			uint32_t result = 0;
+			for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+				if (index & 1) result ^= v;
+			}
+			return result;
+		}
+
+		static uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+			x += seed;
+			x ^= x * 0x6c50b47cu;
+			x ^= x * 0xb82f1e52u;
+			x ^= x * 0xc7afe638u;
+			x ^= x * 0x8d22f6e6u;
+			return x;
+		}
+
+		static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+			return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+		}
+};
+
+enum class sampler_type { independent, stratified, sobol };
+
+// The sampler the current thread's sampling decisions draw from, if any.
+inline sampler*& active_sampler() {
+	thread_local sampler* current = nullptr;
+	return current;
+}
+
+// Makes a sampler the active one for the lifetime of the scope.
+class sampler_scope {
+	public:
+		sampler_scope(sampler& s) : previous(active_sampler()) { active_sampler() = &s; }
+		~sampler_scope() { active_sampler() = previous; }
+
+	private:
+		sampler* previous;
+};
+
+// Next value of the active sampler, or an independent random value when there is none
+// (e.g. while building a scene).
+inline double sample_1d() {
+	auto s = active_sampler();
+	return s ? s->get_1d() : random_double();
+}
+
+inline sample2d sample_2d() {
+	auto s = active_sampler();
+	if (s) return s->get_2d();
+	double r[4];
+	random_double4(r);
+	return {r[0], r[1]};
+}
@@ -20,7 +20,13 @@ class sphere : public intersectable {
 
 		aabb bounding_box() const override { return bbox; }
 
+		void account_memory(memory_usage& usage) const override {
+			usage.add(memory_usage::primitives, "sphere", shared_bytes<sphere>());
+			account_material(mat.get(), usage);
+		}
+
 		bool intersect(const ray& r, interval ray_t, intersects& inte) const override {
+		thread_counters.sphere_tests++;
 		point3d current_center = center.at(r.time());
 		vec3d oc = current_center - r.origin();
 		double a = r.direction().length_squared();
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "memory_usage.h"
 #include "perlin_noise.h"
 #include "image_reader.h"
 
@@ -8,6 +9,13 @@ class texture {
 		virtual ~texture() = default;
 
 		virtual color value(double u, double v, const point3d& p) const = 0;
+
+		// Add the memory held by this texture and the textures it uses to usage, once per texture.
+		void account(memory_usage& usage) const {
+			if (usage.first_visit(this)) account_memory(usage);
+		}
+
+		virtual void account_memory(memory_usage& usage) const {}
 };
 
 class solid_color : public texture {
@@ -19,6 +27,11 @@ class solid_color : public texture {
 		color value(double u, double v, const point3d& p) const override {
 			return albedo;
 		}
+
+		void account_memory(memory_usage& usage) const override {
+			usage.add(memory_usage::textures, "solid_color", shared_bytes<solid_color>());
+		}
+
 	private:
 		color albedo;
 };
@@ -39,6 +52,12 @@ class checker_texture : public texture {
 			return isEven ? even->value(u, v, p) : odd->value(u, v, p);
 		}
 
+		void account_memory(memory_usage& usage) const override {
+			usage.add(memory_usage::textures, "checker_texture", shared_bytes<checker_texture>());
+			even->account(usage);
+			odd->account(usage);
+		}
+
 	private:
 		double inv_scale;
 		shared_ptr<texture> even;
@@ -63,6 +82,10 @@ class image_texture : public texture {
 			return color(color_scale*pixel[0], color_scale*pixel[1], color_scale*pixel[2]);
 		}
 
+		void account_memory(memory_usage& usage) const override {
+			usage.add(memory_usage::textures, "image_texture", shared_bytes<image_texture>() + image.data_bytes());
+		}
+
 	private:
 		read_image image;
 };
@@ -75,6 +98,10 @@ public:
 		return color(0.95, 0.54, 0.66) * (1 + std::sin(scale * p.z() + 10 * noise.turbulence(p, 7)));
 	}
 
+	void account_memory(memory_usage& usage) const override {
+		usage.add(memory_usage::textures, "noise_texture", shared_bytes<noise_texture>());
+	}
+
 private:
 	perlin_noise noise;
 	double scale;
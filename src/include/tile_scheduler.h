@@ -0,0 +1,134 @@
+#pragma once
+
+#include <omp.h>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Rectangular block of pixels [x0, x1) x [y0, y1).
+struct tile {
+	int x0, y0, x1, y1;
+	double cost = 0; // Measured render cost (seconds) from a pilot pass
+
+	int pixel_count() const { return (x1 - x0) * (y1 - y0); }
+};
+
+// Spread the lower 16 bits of x so there is a zero bit between each of them.
+inline uint32_t morton_spread(uint32_t x) {
+	x &= 0x0000ffff;
+	x = (x | (x << 8)) & 0x00ff00ff;
+	x = (x | (x << 4)) & 0x0f0f0f0f;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	return x;
+}
+
+inline uint32_t morton_code(uint32_t x, uint32_t y) {
+	return morton_spread(x) | (morton_spread(y) << 1);
+}
+
+// Split the image into tile_size x tile_size tiles walked in Morton (Z-curve) order.
+inline std::vector<tile> make_tiles(int image_width, int image_height, int tile_size) {
+	tile_size = std::max(1, tile_size);
+	int tiles_x = (image_width + tile_size - 1) / tile_size;
+	int tiles_y = (image_height + tile_size - 1) / tile_size;
+
+	std::vector<std::pair<uint32_t, tile>> keyed;
+	keyed.reserve(size_t(tiles_x) * tiles_y);
+	for (int ty = 0; ty < tiles_y; ++ty) {
+		for (int tx = 0; tx < tiles_x; ++tx) {
+			tile t;
+			t.x0 = tx * tile_size;
+			t.y0 = ty * tile_size;
+			t.x1 = std::min(t.x0 + tile_size, image_width);
+			t.y1 = std::min(t.y0 + tile_size, image_height);
+			keyed.push_back({morton_code(tx, ty), t});
+		}
+	}
+
+	std::sort(keyed.begin(), keyed.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+	std::vector<tile> tiles;
+	tiles.reserve(keyed.size());
+	for (const auto& k : keyed) tiles.push_back(k.second);
+	return tiles;
+}
+
+// Work-stealing scheduler. Each worker owns a deque of tile indices and pops from its front;
+// idle workers steal from the back of the other deques.
+class tile_scheduler {
+	public:
+		// Contiguous runs of the Morton order go to each worker to keep its tiles close together.
+		tile_scheduler(std::vector<tile>& tiles, int workers) : tiles(tiles), queues(std::max(1, workers)) {
+			size_t n = tiles.size();
+			size_t w = queues.size();
+			for (size_t q = 0; q < w; ++q) {
+				for (size_t i = q * n / w; i < (q + 1) * n / w; ++i) queues[q].items.push_back(i);
+			}
+		}
+
+		// Tiles are dealt round-robin in descending cost so every worker starts on an expensive tile
+		// and the cheap ones are left over to fill in the tail.
+		static tile_scheduler cost_ordered(std::vector<tile>& tiles, int workers) {
+			tile_scheduler scheduler(tiles, 0);
+			scheduler.queues = std::vector<work_queue>(std::max(1, workers));
+
+			std::vector<size_t> order(tiles.size());
+			for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+			std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return tiles[a].cost > tiles[b].cost; });
+
+			for (size_t i = 0; i < order.size(); ++i) scheduler.queues[i % scheduler.queues.size()].items.push_back(order[i]);
+			return scheduler;
+		}
+
+		// Call render_tile(tile, worker) for every tile on the OpenMP thread team.
+		template <typename F>
+		void run(F&& render_tile) {
+			int workers = int(queues.size());
+
+			#pragma omp parallel num_threads(workers)
+			{
+				int self = omp_get_thread_num();
+				size_t index;
+				while (pop(self, index) || steal(self, index)) render_tile(tiles[index], self);
+			}
+		}
+
+	private:
+		struct work_queue {
+			std::mutex lock;
+			std::deque<size_t> items;
+
+			work_queue() {}
+			work_queue(work_queue&& other) : items(std::move(other.items)) {}
+			work_queue& operator=(work_queue&& other) { items = std::move(other.items); return *this; }
+		};
+
+		std::vector<tile>& tiles;
+		std::vector<work_queue> queues;
+
+		bool pop(int self, size_t& index) {
+			auto& q = queues[self];
+			std::lock_guard<std::mutex> guard(q.lock);
+			if (q.items.empty()) return false;
+			index = q.items.front();
+			q.items.pop_front();
+			return true;
+		}
+
+		bool steal(int self, size_t& index) {
+			// No work is ever added, so one empty sweep over all victims means we are done.
+			int n = int(queues.size());
+			for (int offset = 1; offset < n; ++offset) {
+				auto& q = queues[(self + offset) % n];
+				std::lock_guard<std::mutex> guard(q.lock);
+				if (q.items.empty()) continue;
+				index = q.items.back();
+				q.items.pop_back();
+				return true;
+			}
+			return false;
+		}
+};
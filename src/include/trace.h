@@ -0,0 +1,129 @@
+#pragma once
+
+// Timeline of scoped events per thread (scene loading, BVH builds, render passes and tiles, image
+// output), written as Chrome trace-event JSON for Perfetto or chrome://tracing. Compiled in only
+// with -DRT_TRACE: otherwise TRACE_SCOPE expands to nothing and its arguments aren't evaluated.
+// A tracing build records nothing until trace_log::get().start() is called.
+//
+//     TRACE_SCOPE("name");
+//     TRACE_SCOPE("name", detail_string);
+
+#ifdef RT_TRACE
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class trace_log {
+	public:
+		struct event {
+			const char* name;
+			std::string detail;
+			double start; // Microseconds since start()
+			double duration;
+		};
+
+		static trace_log& get() {
+			static trace_log log;
+			return log;
+		}
+
+		void start() {
+			origin = std::chrono::steady_clock::now();
+			recording = true;
+			thread_events(); // The calling thread is listed first, as main
+		}
+
+		bool active() const { return recording; }
+
+		double now() const {
+			return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+		}
+
+		// Events of the calling thread. Each thread appends to its own list, so only the first
+		// event of a thread takes the lock.
+		std::vector<event>& thread_events() {
+			thread_local std::vector<event>* events = nullptr;
+			if (!events) {
+				std::lock_guard<std::mutex> guard(lock);
+				threads.push_back(std::make_unique<std::vector<event>>());
+				events = threads.back().get();
+			}
+			return *events;
+		}
+
+		// Call once the traced threads are done.
+		bool write(const std::string& path) const {
+			std::ofstream out(path);
+			if (!out) return false;
+			out << "{\"traceEvents\": [\n";
+			bool first = true;
+			for (size_t tid = 0; tid < threads.size(); ++tid) {
+				out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid
+					<< ", \"args\": {\"name\": \"" << (tid == 0 ? "main" : "thread " + std::to_string(tid)) << "\"}}";
+				first = false;
+				for (const auto& e : *threads[tid]) {
+					out << ",\n{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << tid
+						<< ", \"ts\": " << e.start << ", \"dur\": " << e.duration;
+					if (!e.detail.empty()) out << ", \"args\": {\"detail\": \"" << escaped(e.detail) << "\"}";
+					out << "}";
+				}
+			}
+			out << "\n]}\n";
+			return bool(out);
+		}
+
+	private:
+		bool recording = false;
+		std::chrono::steady_clock::time_point origin;
+		std::mutex lock;
+		std::vector<std::unique_ptr<std::vector<event>>> threads; // In order of each thread's first event
+
+		static std::string escaped(const std::string& text) {
+			std::string out;
+			for (char c : text) {
+				if (c == '"' || c == '\\') out += '\\';
+				out += c;
+			}
+			return out;
+		}
+};
+
+// Records an event from its construction to the end of its scope.
+class trace_scope {
+	public:
+		explicit trace_scope(const char* name, std::string detail = std::string()) : name(name) {
+			if (!trace_log::get().active()) return;
+			this->detail = std::move(detail);
+			start = trace_log::get().now();
+			recording = true;
+		}
+
+		~trace_scope() {
+			if (!recording) return;
+			auto& log = trace_log::get();
+			log.thread_events().push_back({name, std::move(detail), start, log.now() - start});
+		}
+
+		trace_scope(const trace_scope&) = delete;
+		trace_scope& operator=(const trace_scope&) = delete;
+
+	private:
+		const char* name;
+		std::string detail;
+		double start = 0;
+		bool recording = false;
+};
+
+#define TRACE_JOIN_(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN_(a, b)
+#define TRACE_SCOPE(...) trace_scope TRACE_JOIN(trace_scope_, __LINE__)(__VA_ARGS__)
+
+#else
+
+#define TRACE_SCOPE(...) do {} while (0)
+
+#endif
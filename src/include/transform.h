@@ -0,0 +1,107 @@
+#pragma once
+
+#include "3dvec.h"
+#include "aabb.h"
+
+#include <cmath>
+
+// Affine map of space: a linear part and then a translation. Points are mapped by both,
+// directions by the linear part only.
+class transform {
+	public:
+		double m[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}; // Linear part, by rows
+		vec3d offset; // Translation
+
+		transform() {} // The identity
+
+		static transform translation(const vec3d& offset) {
+			transform t;
+			t.offset = offset;
+			return t;
+		}
+
+		// Turn by angle degrees about the y axis, the same way as rotate_y.
+		static transform rotation_y(double angle) {
+			double radians = degrees_to_radians(angle);
+			double c = std::cos(radians), s = std::sin(radians);
+			transform t;
+			t.m[0][0] = c;
+			t.m[0][2] = s;
+			t.m[2][0] = -s;
+			t.m[2][2] = c;
+			return t;
+		}
+
+		static transform scaling(double factor) {
+			transform t;
+			for (int i = 0; i < 3; ++i) t.m[i][i] = factor;
+			return t;
+		}
+
+		// This after b.
+		transform operator*(const transform& b) const {
+			transform t;
+			for (int i = 0; i < 3; ++i) {
+				for (int j = 0; j < 3; ++j) t.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j];
+			}
+			t.offset = point(b.offset);
+			return t;
+		}
+
+		point3d point(const point3d& p) const { return vector(p) + offset; }
+
+		vec3d vector(const vec3d& v) const {
+			return vec3d(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+						 m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+						 m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+		}
+
+		// The transpose of the linear part applied to v. A surface mapped by a transform has its
+		// normals mapped by the transpose of the inverse, so this is called on the inverse.
+		vec3d transposed(const vec3d& v) const {
+			return vec3d(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+						 m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+						 m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+		}
+
+		// By the adjugate of the linear part. The transform must not flatten space.
+		transform inverse() const {
+			transform t;
+			t.m[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+			t.m[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+			t.m[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+			t.m[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+			t.m[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+			t.m[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+			t.m[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+			t.m[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+			t.m[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+			double determinant = m[0][0] * t.m[0][0] + m[0][1] * t.m[1][0] + m[0][2] * t.m[2][0];
+			for (auto& row : t.m) {
+				for (double& x : row) x /= determinant;
+			}
+			t.offset = -t.vector(offset);
+			return t;
+		}
+
+		// Bounds of the mapped box: along each axis, the smallest and largest contribution of every
+		// input axis are summed, which bounds all eight corners. An empty box stays empty, where
+		// its infinite bounds would otherwise give 0 * infinity.
+		aabb box(const aabb& b) const {
+			for (int axis = 0; axis < 3; ++axis) {
+				if (b.axis_interval(axis).size() < 0) return aabb::empty;
+			}
+			interval axes[3];
+			for (int i = 0; i < 3; ++i) {
+				double low = offset[i], high = offset[i];
+				for (int j = 0; j < 3; ++j) {
+					double a = m[i][j] * b.axis_interval(j).min;
+					double c = m[i][j] * b.axis_interval(j).max;
+					low += std::fmin(a, c);
+					high += std::fmax(a, c);
+				}
+				axes[i] = interval(low, high);
+			}
+			return aabb(axes[0], axes[1], axes[2]);
+		}
+};
@@ -23,7 +23,13 @@ public:
 
 	aabb bounding_box() const override { return bbox; }
 
+	void account_memory(memory_usage& usage) const override {
+		usage.add(memory_usage::primitives, "triangle", shared_bytes<triangle>());
+		account_material(mat.get(), usage);
+	}
+
 	bool intersect(const ray& r, interval ray_t, intersects& inte) const override {
+		thread_counters.triangle_tests++;
 		vec3d h = cross(r.direction(), edge2);
 		double a = dot(edge1, h);
 		if (fabs(a) < 1e-8) return false; // Ray parallel to triangle check
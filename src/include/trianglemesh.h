@@ -4,6 +4,7 @@
 
 #include "3dvec.h"
 #include "intersectable.h"
+#include "trace.h"
 #include "triangle.h"
 
 
@@ -18,6 +19,7 @@ public:
 
 private:
     void loadPLY(const std::string& filename, shared_ptr<material> mat) {
+        TRACE_SCOPE("loadPLY", filename);
         std::ifstream file(filename);
         if (!file) {
             std::cerr << "Error opening PLY file: " << filename << "\n";
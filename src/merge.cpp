@@ -0,0 +1,88 @@
+#include "include/film.h"
+#include "include/image_output.h"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Combine partial renders (main --partial) into one image. Each pixel is the sum of the radiance
+// of all partials divided by their total sample count, so region and sample-slice partials can be
+// mixed freely as long as they come from the same scene and camera. Samples are seeded by
+// (pixel, sample), so two partials holding the same sample indices of the same pixels hold the
+// same samples; such overlaps are refused rather than counted twice.
+int main(int argc, char* argv[]) {
+	image_format format = image_format::p6;
+	bool format_given = false;
+	std::string output_file;
+	std::vector<std::string> partials;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string option = argv[i];
+		if (option == "--format" && i + 1 < argc && parse_image_format(argv[i + 1], format)) {
+			format_given = true;
+			i++;
+		} else if (output_file.empty()) {
+			output_file = option;
+		} else {
+			partials.push_back(option);
+		}
+	}
+
+	if (partials.empty()) {
+		std::cerr << "Usage: merge [--format <p3|p6|pfm|png>] <output> <partial>..." << std::endl;
+		return 1;
+	}
+	if (!format_given) format = image_format_for_file(output_file, format);
+
+	film merged;
+	uint64_t merged_hash = 0;
+	std::vector<film_slice> slices;
+	for (size_t k = 0; k < partials.size(); ++k) {
+		const std::string& path = partials[k];
+		film part;
+		uint64_t hash;
+		int tile_size;
+		film_slice slice;
+		if (!part.load(path, hash, tile_size, slice)) {
+			std::cerr << "ERROR: Could not read partial render '" << path << "'." << std::endl;
+			return 1;
+		}
+
+		for (size_t other = 0; other < slices.size(); ++other) {
+			if (!slice.overlaps(slices[other])) continue;
+			std::cerr << "ERROR: '" << path << "' and '" << partials[other] << "' both hold samples ["
+					  << std::max(slice.first_sample, slices[other].first_sample) << ", " << std::min(slice.last_sample, slices[other].last_sample)
+					  << ") of the same pixels. Render partials with different --sample-range or --region." << std::endl;
+			return 1;
+		}
+		slices.push_back(slice);
+
+		if (merged.pixel_count() == 0) {
+			merged = std::move(part);
+			merged_hash = hash;
+		} else if (hash != merged_hash || part.width != merged.width || part.height != merged.height) {
+			std::cerr << "ERROR: '" << path << "' was rendered from a different scene or camera." << std::endl;
+			return 1;
+		} else {
+			merged.merge(part);
+		}
+		std::clog << path << ": " << merged.total_samples() << " samples so far." << std::endl;
+	}
+
+	size_t empty_pixels = 0;
+	std::vector<color> pixels(merged.pixel_count());
+	for (size_t p = 0; p < merged.pixel_count(); ++p) {
+		pixels[p] = merged.pixel(p);
+		empty_pixels += merged.samples[p] == 0;
+	}
+	if (empty_pixels > 0) std::cerr << "WARNING: " << empty_pixels << " pixels have no samples." << std::endl;
+
+	std::ofstream out(output_file, std::ios::binary);
+	if (!out) {
+		std::cerr << "ERROR: Could not open output file '" << output_file << "'." << std::endl;
+		return 1;
+	}
+	write_image(out, format, merged.width, merged.height, pixels);
+	return 0;
+}
@@ -0,0 +1,277 @@
+#include "include/scenes.h"
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Micro-benchmarks of the intersection, traversal and shading kernels. Inputs come from fixed
+// seeds, so every run times the same work and results can be compared across commits on the
+// same machine. Each kernel is timed `repeats` times and the fastest run is reported.
+
+struct kernel_result {
+	std::string name;
+	long long ops;
+	double seconds;
+};
+
+struct bench_settings {
+	double min_seconds = 0.2; // Each timed run repeats the kernel until it has taken this long
+	int repeats = 5;
+	std::string filter; // Only kernels whose name contains this
+};
+
+// The result of every kernel call goes here so the compiler can't drop the work.
+volatile double bench_sink = 0;
+
+// Time batch() (which performs ops_per_batch operations) until min_seconds have passed, repeats
+// times. Reseeds the thread's generator before every run so random draws are the same each time.
+kernel_result time_kernel(const std::string& name, long long ops_per_batch, const std::function<void()>& batch, const bench_settings& settings) {
+	kernel_result best{name, 0, infinity};
+
+	for (int r = 0; r < settings.repeats; ++r) {
+		seed_thread_rng(0, 0, 0);
+		long long ops = 0;
+		auto start = std::chrono::steady_clock::now();
+		double seconds = 0;
+		do {
+			batch();
+			ops += ops_per_batch;
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		} while (seconds < settings.min_seconds);
+
+		if (best.ops == 0 || seconds / ops < best.seconds / best.ops) best = {name, ops, seconds};
+	}
+
+	std::clog << name << ": " << 1e9 * best.seconds / best.ops << " ns/op\n";
+	return best;
+}
+
+// Rays from points on a sphere of the given radius around center, aimed at points within
+// spread of the center, so that some hit the object there and some miss it.
+std::vector<ray> random_rays(const point3d& center, double radius, double spread, int count, uint64_t seed) {
+	pcg32 rng(seed);
+	auto uniform = [&](double lo, double hi) { return lo + (hi - lo) * rng.next_double(); };
+
+	std::vector<ray> rays;
+	rays.reserve(count);
+	for (int k = 0; k < count; ++k) {
+		vec3d from = radius * sample_unit_vector(rng.next_double(), rng.next_double());
+		vec3d to(uniform(-spread, spread), uniform(-spread, spread), uniform(-spread, spread));
+		rays.push_back(ray(center + from, to - from, 0));
+	}
+	return rays;
+}
+
+std::vector<point3d> random_points(double extent, int count, uint64_t seed) {
+	pcg32 rng(seed);
+	std::vector<point3d> points;
+	points.reserve(count);
+	for (int k = 0; k < count; ++k) {
+		points.push_back(point3d(extent * rng.next_double(), extent * rng.next_double(), extent * rng.next_double()));
+	}
+	return points;
+}
+
+// intersect() of one primitive against a fixed set of rays.
+kernel_result bench_intersect(const std::string& name, const intersectable& object, const std::vector<ray>& rays, const bench_settings& settings) {
+	return time_kernel(name, (long long)rays.size(), [&]() {
+		intersects inte;
+		int hits = 0;
+		for (const auto& r : rays) hits += object.intersect(r, interval(0.001, infinity), inte);
+		bench_sink = bench_sink + hits;
+	}, settings);
+}
+
+void bench_primitives(const bench_settings& settings, std::vector<kernel_result>& results) {
+	auto rays = random_rays(point3d(0, 0, 0), 4, 1.5, 4096, 1);
+	auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+	auto match = [&](const std::string& name) { return name.find(settings.filter) != std::string::npos; };
+
+	if (match("aabb_intersect")) {
+		aabb box(point3d(-1, -1, -1), point3d(1, 1, 1));
+		results.push_back(time_kernel("aabb_intersect", (long long)rays.size(), [&]() {
+			int hits = 0;
+			for (const auto& r : rays) hits += box.intersect(r, interval(0.001, infinity));
+			bench_sink = bench_sink + hits;
+		}, settings));
+	}
+
+	if (match("triangle_intersect")) {
+		triangle tri(point3d(-1, -1, 0), point3d(1, -1, 0), point3d(0, 1, 0), mat);
+		results.push_back(bench_intersect("triangle_intersect", tri, rays, settings));
+	}
+
+	if (match("sphere_intersect")) {
+		sphere ball(point3d(0, 0, 0), 1, mat);
+		results.push_back(bench_intersect("sphere_intersect", ball, rays, settings));
+	}
+
+	if (match("quadrilateral_intersect")) {
+		quadrilateral quad(point3d(-1, -1, 0), vec3d(2, 0, 0), vec3d(0, 2, 0), mat);
+		results.push_back(bench_intersect("quadrilateral_intersect", quad, rays, settings));
+	}
+}
+
+// BVH construction over each mesh, and traversal of the built tree. Meshes that aren't on disk
+// are skipped.
+void bench_meshes(const bench_settings& settings, std::vector<kernel_result>& results) {
+	struct mesh_file {
+		const char* name;
+		const char* path;
+	};
+	const mesh_file meshes[] = {
+		{"bunny", "source_images/bunny/reconstruction/bun_zipper.ply"},
+		{"dragon_res4", "source_images/dragon_recon/dragon_vrip_res4.ply"},
+		{"dragon", "source_images/dragon_recon/dragon_vrip.ply"},
+	};
+	auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+	for (const auto& m : meshes) {
+		std::string build_name = std::string("bvh_build_") + m.name;
+		std::string traverse_name = std::string("bvh_intersect_") + m.name;
+		if (build_name.find(settings.filter) == std::string::npos && traverse_name.find(settings.filter) == std::string::npos) continue;
+		if (!std::ifstream(m.path)) continue;
+
+		TriangleMesh mesh(m.path, mat);
+		if (mesh.triangles.empty()) continue;
+
+		if (build_name.find(settings.filter) != std::string::npos) {
+			// The builder sorts its input, so every build starts from a fresh copy of the load order.
+			std::vector<shared_ptr<intersectable>> objects;
+			results.push_back(time_kernel(build_name, 1, [&]() {
+				objects = mesh.triangles;
+				bvh_node tree(objects, 0, objects.size());
+				bench_sink = bench_sink + tree.bounding_box().x.size();
+			}, settings));
+		}
+
+		if (traverse_name.find(settings.filter) != std::string::npos) {
+			auto objects = mesh.triangles;
+			bvh_node tree(objects, 0, objects.size());
+			std::clog << m.name << ": SAH cost " << tree.sah_cost() << "\n";
+			aabb bounds = tree.bounding_box();
+			point3d center(bounds.x.min + bounds.x.size() / 2, bounds.y.min + bounds.y.size() / 2, bounds.z.min + bounds.z.size() / 2);
+			double extent = std::fmax(bounds.x.size(), std::fmax(bounds.y.size(), bounds.z.size()));
+			auto rays = random_rays(center, 2 * extent, extent / 4, 4096, 2);
+			results.push_back(bench_intersect(traverse_name, tree, rays, settings));
+		}
+	}
+}
+
+void bench_textures(const bench_settings& settings, std::vector<kernel_result>& results) {
+	auto match = [&](const std::string& name) { return name.find(settings.filter) != std::string::npos; };
+	auto points = random_points(8, 4096, 3);
+
+	if (match("perlin_turbulence")) {
+		seed_thread_rng(0, 0, 0); // The noise tables are drawn from the thread's generator
+		perlin_noise noise;
+		results.push_back(time_kernel("perlin_turbulence", (long long)points.size(), [&]() {
+			double total = 0;
+			for (const auto& p : points) total += noise.turbulence(p, 7);
+			bench_sink = bench_sink + total;
+		}, settings));
+	}
+
+	if (match("image_texture_value") && std::ifstream("source_images/earth.jpg")) {
+		image_texture earth("earth.jpg");
+		results.push_back(time_kernel("image_texture_value", (long long)points.size(), [&]() {
+			double total = 0;
+			for (const auto& p : points) total += earth.value(p.x() / 8, p.y() / 8, p).x();
+			bench_sink = bench_sink + total;
+		}, settings));
+	}
+}
+
+// scatter() of each material at a fixed set of front and back face hits.
+void bench_materials(const bench_settings& settings, std::vector<kernel_result>& results) {
+	struct material_case {
+		const char* name;
+		shared_ptr<material> mat;
+	};
+	const material_case materials[] = {
+		{"lambertian", make_shared<lambertian>(color(0.73, 0.73, 0.73))},
+		{"metal", make_shared<metal>(color(0.8, 0.85, 0.88), 0.3)},
+		{"dielectric", make_shared<dielectric>(1.5)},
+		{"diffuse_light", make_shared<diffuse_light>(color(4, 4, 4))},
+		{"isotropic", make_shared<isotropic>(color(0.2, 0.4, 0.9))},
+	};
+
+	// Rays hitting the unit sphere from outside and inside.
+	auto rays = random_rays(point3d(0, 0, 0), 4, 0.5, 1024, 4);
+	auto inner = random_rays(point3d(0, 0, 0), 0.5, 0.5, 1024, 5);
+	rays.insert(rays.end(), inner.begin(), inner.end());
+	sphere ball(point3d(0, 0, 0), 1, nullptr);
+	std::vector<ray> incoming;
+	std::vector<intersects> hits;
+	for (const auto& r : rays) {
+		intersects inte;
+		if (ball.intersect(r, interval(0.001, infinity), inte)) {
+			incoming.push_back(r);
+			hits.push_back(inte);
+		}
+	}
+
+	for (const auto& m : materials) {
+		std::string name = std::string("scatter_") + m.name;
+		if (name.find(settings.filter) == std::string::npos) continue;
+		for (auto& inte : hits) inte.mat = m.mat;
+
+		results.push_back(time_kernel(name, (long long)hits.size(), [&]() {
+			ray scattered;
+			color attenuation;
+			double total = 0;
+			for (size_t k = 0; k < hits.size(); ++k) {
+				if (m.mat->scatter(incoming[k], hits[k], attenuation, scattered)) total += scattered.direction().x() + attenuation.x();
+			}
+			bench_sink = bench_sink + total;
+		}, settings));
+	}
+}
+
+void write_results(std::ostream& out, const std::vector<kernel_result>& results, const bench_settings& settings) {
+	out << "{\n";
+	out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+	out << "  \"min_seconds\": " << settings.min_seconds << ",\n";
+	out << "  \"repeats\": " << settings.repeats << ",\n";
+	out << "  \"benchmarks\": [\n";
+	for (size_t k = 0; k < results.size(); ++k) {
+		const auto& r = results[k];
+		out << "    {\"name\": \"" << r.name << "\", \"ops\": " << r.ops << ", \"ns_per_op\": " << 1e9 * r.seconds / r.ops
+			<< ", \"ops_per_second\": " << r.ops / r.seconds << "}" << (k + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n";
+	out << "}\n";
+}
+
+int main(int argc, char* argv[]) {
+	bench_settings settings;
+	std::string output_file;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string option = argv[i];
+		if (option == "--min-time" && i + 1 < argc) settings.min_seconds = std::stod(argv[++i]);
+		else if (option == "--repeats" && i + 1 < argc) settings.repeats = std::max(1, std::stoi(argv[++i]));
+		else if (option == "--filter" && i + 1 < argc) settings.filter = argv[++i];
+		else if (option == "--output" && i + 1 < argc) output_file = argv[++i];
+		else {
+			std::cerr << "Unrecognized option " + option + " passed." << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<kernel_result> results;
+	bench_primitives(settings, results);
+	bench_meshes(settings, results);
+	bench_textures(settings, results);
+	bench_materials(settings, results);
+
+	if (output_file.empty()) {
+		write_results(std::cout, results, settings);
+	} else {
+		std::ofstream out(output_file);
+		write_results(out, results, settings);
+	}
+}
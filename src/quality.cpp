@@ -0,0 +1,193 @@
+#include "include/scenes.h"
+
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Equal-time quality regression. `quality reference` renders high sample count references of the
+// scenes once and keeps them as PFM; `quality score` renders the same scenes for a fixed time with
+// the current build and scores them against the references. A change that makes rendering faster
+// but adds bias or noise shows up as a worse score, not a better one.
+//
+// Samples are seeded from (pixel, sample, frame), so a reference rendered like the scored images
+// would repeat their first samples exactly and the score would measure a render against itself.
+// References are rendered as a frame no scored render uses, which gives them sample streams of
+// their own.
+
+struct quality_settings {
+	std::string directory = "references";
+	int image_width = 200;
+	int reference_samples = 4096;
+	double seconds = 10; // Time budget of each scored render
+	int threads = std::max(1, int(std::thread::hardware_concurrency()));
+	bool wavefront = false;
+	std::string output_file;
+};
+
+// Frame number of the references. Scored renders are frame 0.
+const int reference_frame = 1 << 20;
+
+struct quality_score {
+	int scene;
+	double seconds;
+	double samples_per_pixel;
+	double rmse; // Root mean square error of the linear radiance
+	double relmse; // Mean squared error relative to the squared reference value
+	double efficiency; // 1 / (relMSE * seconds): higher is better, and independent of the time given
+};
+
+std::string reference_path(const quality_settings& settings, int index) {
+	return settings.directory + "/scene" + std::to_string(index) + ".pfm";
+}
+
+// Scenes with random content draw it from the thread's generator, so every build starts it from
+// the same state to get the same scene.
+bool load_scene(int index, scene& s) {
+	thread_rng() = pcg32();
+	thread_rng4() = pcg32x4();
+	if (!build_scene(index, s)) {
+		std::cerr << "Unrecognized scene " << index << ".\n";
+		return false;
+	}
+	return true;
+}
+
+std::vector<color> film_pixels(const film& image) {
+	std::vector<color> pixels(image.pixel_count());
+	for (size_t p = 0; p < pixels.size(); ++p) pixels[p] = image.pixel(p);
+	return pixels;
+}
+
+void render_reference(int index, const quality_settings& settings) {
+	scene s;
+	if (!load_scene(index, s)) return;
+
+	s.cam.image_width = settings.image_width;
+	s.cam.random_samples_per_pixel = settings.reference_samples;
+	s.cam.threads = settings.threads;
+	s.cam.frame = reference_frame;
+	s.cam.write_output = false;
+	film image = s.cam.render(s.world);
+
+	std::string path = reference_path(settings, index);
+	std::ofstream out(path, std::ios::binary);
+	if (!out) {
+		std::cerr << "ERROR: Could not open reference file '" << path << "'.\n";
+		return;
+	}
+	write_image(out, image_format::pfm, image.width, image.height, film_pixels(image));
+}
+
+bool score_scene(int index, const quality_settings& settings, quality_score& score) {
+	std::ifstream in(reference_path(settings, index), std::ios::binary);
+	int width, height;
+	std::vector<color> reference;
+	if (!in || !read_pfm(in, width, height, reference)) {
+		std::cerr << "No reference for scene " << index << " in '" << settings.directory << "', skipped.\n";
+		return false;
+	}
+
+	scene s;
+	if (!load_scene(index, s)) return false;
+
+	s.cam.image_width = width;
+	s.cam.time_budget = settings.seconds;
+	s.cam.threads = settings.threads;
+	s.cam.write_output = false;
+	if (settings.wavefront) s.cam.mode = render_mode::wavefront;
+
+	auto start = std::chrono::steady_clock::now();
+	film image = s.cam.render(s.world);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (image.width != width || image.height != height) {
+		std::cerr << "Reference for scene " << index << " is " << width << "x" << height << " but the render is "
+				  << image.width << "x" << image.height << ", skipped.\n";
+		return false;
+	}
+
+	double squared = 0, relative = 0;
+	for (size_t p = 0; p < reference.size(); ++p) {
+		color d = image.pixel(p) - reference[p];
+		for (int c = 0; c < 3; ++c) {
+			squared += d[c] * d[c];
+			relative += d[c] * d[c] / (reference[p][c] * reference[p][c] + 0.01);
+		}
+	}
+	double n = 3.0 * reference.size();
+
+	score.scene = index;
+	score.seconds = seconds;
+	score.samples_per_pixel = double(image.total_samples()) / image.pixel_count();
+	score.rmse = std::sqrt(squared / n);
+	score.relmse = relative / n;
+	score.efficiency = 1 / (score.relmse * seconds);
+	return true;
+}
+
+void write_scores(std::ostream& out, const std::vector<quality_score>& scores, const quality_settings& settings) {
+	out << "{\n";
+	out << "  \"seconds\": " << settings.seconds << ",\n";
+	out << "  \"threads\": " << settings.threads << ",\n";
+	out << "  \"scenes\": [\n";
+	for (size_t k = 0; k < scores.size(); ++k) {
+		const auto& s = scores[k];
+		out << "    {\"scene\": " << s.scene << ", \"seconds\": " << s.seconds << ", \"samples_per_pixel\": " << s.samples_per_pixel
+			<< ", \"rmse\": " << s.rmse << ", \"relmse\": " << s.relmse << ", \"efficiency\": " << s.efficiency << "}"
+			<< (k + 1 < scores.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n";
+	out << "}\n";
+}
+
+int main(int argc, char* argv[]) {
+	std::string command = argc > 1 ? argv[1] : "";
+	if (command != "reference" && command != "score") {
+		std::cerr << "Usage: quality reference [scene...] [--dir d] [--width w] [--samples n] [--threads n]\n"
+				  << "       quality score [scene...] [--dir d] [--time s] [--threads n] [--wavefront] [--output f]\n";
+		return 1;
+	}
+
+	quality_settings settings;
+	std::vector<int> scenes;
+	for (int i = 2; i < argc; ++i) {
+		std::string option = argv[i];
+		if (option == "--dir" && i + 1 < argc) settings.directory = argv[++i];
+		else if (option == "--width" && i + 1 < argc) settings.image_width = std::stoi(argv[++i]);
+		else if (option == "--samples" && i + 1 < argc) settings.reference_samples = std::stoi(argv[++i]);
+		else if (option == "--time" && i + 1 < argc) settings.seconds = std::stod(argv[++i]);
+		else if (option == "--threads" && i + 1 < argc) settings.threads = std::max(1, std::stoi(argv[++i]));
+		else if (option == "--wavefront") settings.wavefront = true;
+		else if (option == "--output" && i + 1 < argc) settings.output_file = argv[++i];
+		else scenes.push_back(std::stoi(option));
+	}
+	// Scenes whose assets are all in the repository: textures, media, meshes and plain geometry.
+	if (scenes.empty()) scenes = {2, 3, 7, 8, 9, 11, 13};
+
+	if (command == "reference") {
+		std::filesystem::create_directories(settings.directory);
+		for (int index : scenes) render_reference(index, settings);
+		return 0;
+	}
+
+	std::vector<quality_score> scores;
+	for (int index : scenes) {
+		quality_score score;
+		if (score_scene(index, settings, score)) {
+			scores.push_back(score);
+			std::clog << std::defaultfloat << "Scene " << index << ": " << score.samples_per_pixel << " spp, RMSE " << score.rmse
+					  << ", relMSE " << score.relmse << ", efficiency " << score.efficiency << "\n";
+		}
+	}
+
+	if (settings.output_file.empty()) {
+		write_scores(std::cout, scores, settings);
+	} else {
+		std::ofstream out(settings.output_file);
+		write_scores(out, scores, settings);
+	}
+}
@@ -0,0 +1,100 @@
+#include "include/scenes.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Trace the rays of a capture (main --capture-rays) against the scene's acceleration structure,
+// without any shading, and check every hit against the one recorded during the render.
+
+struct replay_result {
+	long long hits = 0;
+	long long mismatches = 0;
+	double seconds = 0;
+};
+
+replay_result replay(const intersectable& world, const std::vector<captured_ray>& rays, int threads, int repeats) {
+	replay_result result;
+	std::vector<char> hit(rays.size());
+	std::vector<double> hit_t(rays.size());
+	result.seconds = infinity;
+
+	for (int r = 0; r < repeats; ++r) {
+		auto start = std::chrono::steady_clock::now();
+		#pragma omp parallel for num_threads(threads) schedule(dynamic, 1024)
+		for (long long k = 0; k < (long long)rays.size(); ++k) {
+			intersects inte;
+			hit[k] = world.intersect(rays[k].get_ray(), interval(rays[k].t_min, rays[k].t_max), inte);
+			hit_t[k] = hit[k] ? inte.t : infinity;
+		}
+		result.seconds = std::min(result.seconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	for (size_t k = 0; k < rays.size(); ++k) {
+		result.hits += hit[k];
+		bool same = bool(hit[k]) == bool(rays[k].hit)
+				 && (!hit[k] || std::fabs(hit_t[k] - rays[k].hit_t) <= 1e-9 * std::fmax(1.0, std::fabs(rays[k].hit_t)));
+		result.mismatches += !same;
+	}
+	return result;
+}
+
+void report(const std::string& label, const std::vector<captured_ray>& rays, const replay_result& r) {
+	if (rays.empty()) return;
+	std::cout << label << ": " << rays.size() << " rays, " << 100.0 * r.hits / rays.size() << "% hit, "
+			  << rays.size() / r.seconds / 1e6 << " Mrays/s, " << r.hits / r.seconds / 1e6 << " Mhits/s, "
+			  << r.mismatches << " mismatches\n";
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 3) {
+		std::cerr << "Usage: replay <scene> <capture file> [--threads n] [--repeats n]\n";
+		return 1;
+	}
+
+	int threads = 1;
+	int repeats = 3;
+	for (int i = 3; i < argc; ++i) {
+		std::string option = argv[i];
+		if (option == "--threads" && i + 1 < argc) threads = std::max(1, std::stoi(argv[++i]));
+		else if (option == "--repeats" && i + 1 < argc) repeats = std::max(1, std::stoi(argv[++i]));
+		else {
+			std::cerr << "Unrecognized option " + option + " passed." << std::endl;
+			return 1;
+		}
+	}
+
+	scene s;
+	if (!build_scene(std::stoi(argv[1]), s)) {
+		std::cerr << "Unrecognized scene " << argv[1] << ".\n";
+		return 1;
+	}
+
+	aabb bounds;
+	std::vector<captured_ray> rays;
+	if (!load_ray_capture(argv[2], bounds, rays)) {
+		std::cerr << "ERROR: Could not read ray capture file '" << argv[2] << "'.\n";
+		return 1;
+	}
+
+	aabb world_bounds = s.world.bounding_box();
+	for (int axis = 0; axis < 3; ++axis) {
+		if (bounds.axis_interval(axis).min != world_bounds.axis_interval(axis).min || bounds.axis_interval(axis).max != world_bounds.axis_interval(axis).max) {
+			std::cerr << "WARNING: The capture was made from a scene with different bounds.\n";
+			break;
+		}
+	}
+
+	// Camera rays are coherent and secondary rays are not, so they are timed apart as well.
+	std::vector<captured_ray> camera_rays, secondary_rays;
+	for (const auto& r : rays) (r.bounce == 0 ? camera_rays : secondary_rays).push_back(r);
+
+	replay_result all = replay(s.world, rays, threads, repeats);
+	report("camera", camera_rays, replay(s.world, camera_rays, threads, repeats));
+	report("secondary", secondary_rays, replay(s.world, secondary_rays, threads, repeats));
+	report("all", rays, all);
+
+	return all.mismatches > 0 ? 2 : 0;
+}